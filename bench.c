@@ -0,0 +1,229 @@
+///\file bench.c
+///\brief Microbenchmark firmware
+///
+/// Built with 'make bench' into bench.elf, next to the adapter firmware. It calls
+/// the routines on the hot path of the main loop BENCH_CALLS times each, with
+/// interrupts disabled and input varying from call to call, and prints minimal,
+/// average and maximal CPU cycles per call over the USART:
+///  - mouse_decode(): 3-byte packet decode and sign extension
+///  - potmouse_movt() in proportional and joystick mode
+///  - ps2_getbyte() and uart_getc()
+///  - printf_P() formatting, into a stream that discards the output, and the
+///    same output through out.h
+///
+/// Timer1 counts CPU cycles. Cost of an empty call through the harness is
+/// subtracted, so the counts include argument setup and the call itself.
+/// In joystick mode potmouse_movt() programs Timer1 for its pulse, so it is timed
+/// with Timer2 at clk/1 instead, with the overflow flag that's good for up to 511 cycles.
+///
+/// Counts are exact and don't depend on anything outside the chip, so the same build
+/// gives the same numbers in simavr ('make bench-sim'). When done, the firmware
+/// drains the USART and sleeps with interrupts disabled, which ends the simulation.
+///
+/// Unverified: this has not been built or run yet, neither avr-gcc nor simavr was at
+/// hand. There are no cycle figures until it has, and a first run may need fixes.
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <stdio.h>
+
+#include "usrat.h"
+#include "out.h"
+#include "ps2.h"
+#include "mouse.h"
+#include "c1351.h"
+#include "timing.h"
+
+#define BAUDRATE    19200   ///< USART baudrate
+#define BENCH_CALLS 64      ///< Calls per routine
+
+/// Routine under test, called with the call number
+typedef void (*BenchFunc)(uint8_t i);
+
+/// Cycles per call of one routine
+typedef struct _benchstat {
+    uint16_t min;                       ///< fastest call
+    uint16_t max;                       ///< slowest call
+    uint32_t sum;                       ///< all calls
+} BenchStat;
+
+/// Packets with every combination of sign bits and buttons
+static MouseMovt packets[8] = {
+    {{0x08, 0x00, 0x00}}, {{0x18, 0xff, 0x01}}, {{0x28, 0x10, 0xf0}}, {{0x38, 0x80, 0x80}},
+    {{0x09, 0x7f, 0x7f}}, {{0x1a, 0x01, 0xfe}}, {{0x2c, 0x40, 0x20}}, {{0x3f, 0xc0, 0x03}},
+};
+
+/// Movement deltas, from still to the largest a packet can bring
+static const int16_t deltas[8] = {0, 1, -1, 5, -12, 40, -100, -256};
+
+static DecodedMovt movt;
+static volatile uint8_t sink;
+static FILE *null_out;
+
+static int null_put(char c) {
+    return 0;
+}
+
+static void b_none(uint8_t i) {
+}
+
+static void b_decode(uint8_t i) {
+    mouse_decode(&packets[i & 7], &movt);
+}
+
+static void b_movt(uint8_t i) {
+    potmouse_movt(deltas[i & 7], deltas[(i + 3) & 7], i & 7);
+}
+
+static void b_ps2(uint8_t i) {
+    sink = ps2_getbyte();
+}
+
+static void b_uart(uint8_t i) {
+    sink = uart_getc();
+}
+
+static void b_printf(uint8_t i) {
+    printf_P(PSTR("X=%+6d Y=%+6d\n"), deltas[i & 7], deltas[(i + 5) & 7]);
+}
+
+static void b_hex(uint8_t i) {
+    printf_P(PSTR("%02x "), i);
+}
+
+static void b_out(uint8_t i) {
+    OUT_P("X=");
+    out_sdec(deltas[i & 7], 6, 1);
+    OUT_P(" Y=");
+    out_sdec(deltas[(i + 5) & 7], 6, 1);
+    out_char('\n');
+}
+
+static void b_outhex(uint8_t i) {
+    out_hex8(i);
+    out_char(' ');
+}
+
+/// \brief Time one call with Timer1.
+static uint16_t bench_t1(BenchFunc f, uint8_t i) {
+    uint16_t start = TCNT1;
+    f(i);
+    return TCNT1 - start;
+}
+
+/// \brief Time one call with Timer2, for routines that use Timer1.
+static uint16_t bench_t2(BenchFunc f, uint8_t i) {
+    uint8_t start, end;
+
+    TIFR = _BV(TOV2);
+    start = TCNT2;
+    f(i);
+    end = TCNT2;
+
+    return (uint16_t)end + ((TIFR & _BV(TOV2)) ? 256 : 0) - start;
+}
+
+/// \brief Call f BENCH_CALLS times.
+/// \param t2 time with Timer2 instead of Timer1
+/// \param st result, overhead of an empty call subtracted
+static void bench_run(BenchFunc f, uint8_t t2, BenchStat *st) {
+    uint16_t overhead = 0xffff;
+    uint16_t c;
+    uint8_t i;
+
+    for (i = 0; i < 8; i++) {
+        c = t2 ? bench_t2(b_none, i) : bench_t1(b_none, i);
+        if (c < overhead) overhead = c;
+    }
+
+    st->min = 0xffff;
+    st->max = 0;
+    st->sum = 0;
+    for (i = 0; i < BENCH_CALLS; i++) {
+        c = (t2 ? bench_t2(f, i) : bench_t1(f, i)) - overhead;
+        if (c < st->min) st->min = c;
+        if (c > st->max) st->max = c;
+        st->sum += c;
+    }
+}
+
+/// \brief Print one result line.
+static void bench_print(PGM_P name, BenchStat *st) {
+    printf_P(PSTR("%-20S %6u %6u %6u\n"), name, st->min, (uint16_t)(st->sum / BENCH_CALLS), st->max);
+}
+
+int main() {
+    BenchStat decode, movt1351, movtjoy, ps2, uart, fmt, hex, outdec, outhex;
+    FILE *out;
+
+    // first stream opened becomes stdout
+    usart_init(USART_UBRR(BAUDRATE));
+    (void)fdevopen(uart_putchar, NULL);
+    null_out = fdevopen(null_put, NULL);
+
+    printf_P(PSTR("\n[M]AUS BENCH B%s F_CPU=%lu\n"), BUILDNUM, (unsigned long)(F_CPU));
+
+    // drain the banner, measurements run with interrupts disabled
+    sei();
+    while (uart_txspace() != TX_BUFFER_SIZE);
+    cli();
+
+    potmouse_init();
+
+    // Timer1 counts CPU cycles
+    potmouse_start(POTMOUSE_C1351);
+    GICR &= ~_BV(INT1);
+    TCCR1A = 0;
+    TCCR1B = T1_CS_HIRES;
+
+    bench_run(b_decode, 0, &decode);
+    bench_run(b_movt, 0, &movt1351);
+    bench_run(b_ps2, 0, &ps2);
+    bench_run(b_uart, 0, &uart);
+
+    out = stdout;
+    stdout = null_out;
+    bench_run(b_printf, 0, &fmt);
+    bench_run(b_hex, 0, &hex);
+    stdout = out;
+
+    out_redirect(null_put);
+    bench_run(b_out, 0, &outdec);
+    bench_run(b_outhex, 0, &outhex);
+    out_redirect(0);
+
+    // joystick mode owns Timer1
+    potmouse_start(POTMOUSE_JOYSTICK);
+    TCCR2 = _BV(CS20);
+    bench_run(b_movt, 1, &movtjoy);
+    potmouse_start(POTMOUSE_C1351);
+    GICR &= ~_BV(INT1);
+
+    sei();
+    printf_P(PSTR("%-20S %6S %6S %6S\n"), PSTR("cycles per call"), PSTR("min"), PSTR("avg"), PSTR("max"));
+    bench_print(PSTR("mouse_decode"), &decode);
+    bench_print(PSTR("potmouse_movt 1351"), &movt1351);
+    bench_print(PSTR("potmouse_movt joy"), &movtjoy);
+    bench_print(PSTR("ps2_getbyte"), &ps2);
+    bench_print(PSTR("uart_getc"), &uart);
+    bench_print(PSTR("printf_P %+6d x2"), &fmt);
+    bench_print(PSTR("printf_P %02x"), &hex);
+    bench_print(PSTR("out_sdec x2"), &outdec);
+    bench_print(PSTR("out_hex8"), &outhex);
+    printf_P(PSTR("END\n"));
+
+    // let the last character go out, then stop
+    while (uart_txspace() != TX_BUFFER_SIZE);
+    _delay_ms(2);
+
+    cli();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    for (;;) sleep_cpu();
+}
+
+//$Id$
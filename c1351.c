@@ -7,7 +7,83 @@
 //! and loads timer OCR1A/OCR1B values with accordance to reported counter values.
 //!
 //! In Joystick mode, pulses are generated on UP/DOWN/LEFT/RIGHT joystick lines
-//! every time a movement is reported.
+//! every time a movement is reported.
+//!
+//! Optionally, proportional mode predicts motion between PS/2 reports. Mouse reports
+//! come at 100Hz while SID measures every 512us, so INT1 doubles as a timebase:
+//! velocity of every axis is estimated in counts per SID cycle from the last report
+//! and potmouse_poll() extrapolates the counters to where they should be at the next
+//! SID sample. Extrapolation stops after one report interval, as measured between the
+//! last two reports; if no report has come by then, the mouse has stopped and so does
+//! the pointer. What was extrapolated stays in the counters and is taken from the next
+//! report, so motion is never counted twice.
+//!
+//! Pot edges are placed by Timer1. Normally it counts at clk/T1_PRESCALER, 1us at 8MHz,
+//! so a 1351 count, which is a little over 2us, comes out as 2 or 3 ticks, and
+//! the free-running prescaler adds up to one more tick of random delay. In high
+//! resolution mode (potmouse_hires()) Timer1 counts CPU cycles. The count-to-ticks
+//! scale is 8.8 fixed point in both cases, so edges are exactly spaced
+//! to within a fraction of a tick.
+//!
+//! Everything the C64 sees is composed in the main loop into complete output images:
+//! OCR values and JOYDDR bits for buttons (and directions in joystick mode), looked up in
+//! per-mode tables. In the modes timed by SID, a finished image is published by flipping
+//! a double buffer, and INT1 commits all of it right after starting Timer1, at the
+//! start of the measurement cycle while SID discharges the pots. Every cycle the C64
+//! samples thus sees position and buttons from the same report, and the port never
+//! changes in the middle of a measurement. Other modes write each port with
+//! a single store of its complete image.
+//!
+//! Paddle and KoalaPad modes use the same SID timing as proportional mode, but
+//! instead of 6-bit wrapping counters they integrate movement into an absolute
+//! 8-bit position per axis (with gain and clamping) and output it as a full pot value.
+//! Buttons go to LEFT/RIGHT joystick lines, where paddles and the pad have them.
+//!
+//! In Amiga and Atari ST modes, movement is added to per-axis backlog accumulators
+//! and Timer1 compare interrupt steps XA/XB/YA/YB quadrature phases on the joystick
+//! lines, one edge per axis per tick, until the backlog is drained. The tick rate
+//! is the maximal edge rate, see potmouse_edgerate(). Pin assignment:
+//!
+//! <pre>
+//! DB9 pin     1       2       3       4       6       9       5
+//! C64         UP      DOWN    LEFT    RIGHT   FIRE    POTX    POTY
+//! Amiga       V       H       VQ      HQ      LMB     RMB     MMB
+//! Atari ST    XB      XA      YA      YB      LMB     RMB     -
+//! NEOS        D0      D1      D2      D3      strobe  RMB     -
+//! </pre>
+//!
+//! NEOS mode answers the C64 driver, which drives FIRE as a strobe output. Deltas
+//! are sent as 8-bit two's complement, x growing to the left and y growing up, in four
+//! nibbles: XH while the strobe is low, XL after it goes high, YH after it goes low
+//! and YL after it goes high again. The falling edge after YL completes the sequence.
+//! A 1 bit pulls its line low. Left button is FIRE, the same wire as the strobe,
+//! so like on a real NEOS mouse it stops the strobe while pressed.
+//!
+//! FIRE has no pin change interrupt, but it is also ADC1: with the ADC off, the
+//! multiplexer puts it on the negative input of the analog comparator, with the
+//! bandgap reference on the positive one, and the comparator interrupt on both edges
+//! is the strobe interrupt. The handler takes the strobe level from the comparator
+//! output, not from the pin, which on a slow rising edge may still read low.
+//! All four nibbles are prepared by the main loop as JOYDDR images, and the strobe
+//! handler only steps through them. Deltas are latched at sequence boundaries: the main
+//! loop keeps a second image with the newest deltas, which it can take back and
+//! recompose until the handler picks it up at the end of a sequence. Without one the
+//! handler shows an image without deltas, so nothing is read twice. A sequence
+//! abandoned for NEOS_TIMEOUT_US is shown again from XH with the same deltas, so motion is
+//! neither lost nor counted twice. Every edge restarts Timer1, and potmouse_poll() takes
+//! its compare flag as the timeout, well before the C64 reads again in the next frame.
+//! An edge of the wrong direction for the next nibble (the C64 returning the strobe to
+//! low after a timeout) is skipped. A stray edge while the bandgap starts up is
+//! undone by the timeout too.
+//!
+//! Strobe-to-nibble latency is the handler's path to the JOYDDR store, checked by the
+//! timing target in the Makefile to stay within NEOS_BUDGET cycles, plus whatever
+//! holds the comparator interrupt off: it has the lowest priority of all vectors.
+//! The timing target adds up the worst case of that too, from the masked stretches
+//! of the other handlers, and checks it against the C64's wait.
+//! tools/neosread.c plays a C64 driver against this code and reports the latency
+//! distribution, with the other handlers holding the strobe interrupt off as long
+//! as the timing analysis or, until that has run, a hand count says they can.
 
 #include <inttypes.h>
 #include <avr/io.h>
@@ -17,107 +93,709 @@
 #include <stdio.h>
 
 #include "ioconfig.h"
+#include "timing.h"
+#include "ring.h"
 #include "c1351.h"
 #include "ps2.h"
 
 static uint8_t potmouse_xcounter;           ///< x axis counter
 static uint8_t potmouse_ycounter;           ///< y axis counter
 
-static volatile uint16_t ocr1a_load;        ///< precalculated OCR1A value (YPOT)
-static volatile uint16_t ocr1b_load;        ///< precalculated OCR1B value (XPOT)
+/// Output image committed by INT1
+typedef struct _potframe {
+    uint16_t ocr1a;                         ///< OCR1A value (YPOT)
+    uint16_t ocr1b;                         ///< OCR1B value (XPOT)
+    uint8_t joyddr;                         ///< complete JOYDDR value
+} PotFrame;
+
+static PotFrame frames[2];                  ///< published and next output image
+static volatile uint8_t frame_front;        ///< index of published image
+static uint16_t frame_a, frame_b;           ///< OCR values of last composed image
+
+static uint8_t joy_keep;                    ///< JOYDDR bits that aren't joystick lines
+static uint8_t pot_keep;                    ///< POTDDR bits that aren't pot lines
+static uint8_t btn_joy[8];                  ///< JOYDDR bits for every button combination
+static uint8_t btn_pot[8];                  ///< POTDDR bits for every button combination
+static uint8_t joy_buttons;                 ///< JOYDDR bits of current buttons
+static volatile uint8_t joy_rest;           ///< JOYDDR value after joystick pulse
+static volatile uint8_t pot_rest;           ///< POTDDR value after joystick pulse
+
+/// JOYDDR bits for joystick directions, indexed by sign + 1
+static const uint8_t dir_x[3] = {_BV(JOYLEFT), 0, _BV(JOYRIGHT)};
+static const uint8_t dir_y[3] = {_BV(JOYDOWN), 0, _BV(JOYUP)};
 
 static volatile uint16_t ocr_zero;          ///< zero point (320us)
+static uint16_t ocr_base;                   ///< timer value for pot value 0
+static uint16_t zero_us = 320;              ///< zero point, us
+
+static uint8_t t1_cs = T1_CS;               ///< Timer1 clock select for pot timing
+static uint16_t pot_step_q8;                ///< Timer1 ticks per 1351 count, 8.8
+static uint16_t pot_unit_q8;                ///< Timer1 ticks per SID pot value, 8.8
+static uint8_t t1_per_10us;                 ///< Timer1 ticks per 10us
+
+static int16_t abs_x;                       ///< absolute x position, 12.4 fixed point
+static int16_t abs_y;                       ///< absolute y position, 12.4 fixed point
+static uint8_t abs_gain = POTMOUSE_GAIN_DEFAULT; ///< pot units per count, 4.4
+static int16_t abs_min;                     ///< lowest position, 12.4
+static int16_t abs_max;                     ///< highest position, 12.4
 
 static volatile uint8_t mode;               ///< mouse mode
 
+static volatile uint8_t sid_cycles;         ///< SID measurement cycles, wrapping
+static uint8_t pred_on;                     ///< motion prediction enabled
+static uint8_t pred_active;                 ///< prediction in progress
+static volatile uint8_t pred_age;           ///< SID cycles since last report, stops at 255
+static uint8_t pred_seen;                   ///< sid_cycles at last potmouse_poll() update
+static uint8_t pred_span;                   ///< expected report interval, SID cycles
+static uint8_t pred_held;                   ///< extrapolation ended, waiting for a report
+static int8_t pred_owe_x;                   ///< x counts extrapolated ahead of the reports
+static int8_t pred_owe_y;                   ///< y counts extrapolated ahead of the reports
+static int16_t pred_vx;                     ///< x velocity, counts per SID cycle, 8.8
+static int16_t pred_vy;                     ///< y velocity, counts per SID cycle, 8.8
+
+/// Reports further apart than this many SID cycles (~20ms) mean motion has just started
+#define PRED_MAX_GAP    40
+
+static volatile int16_t quad_xbacklog;      ///< quadrature x counts not yet emitted
+static volatile int16_t quad_ybacklog;      ///< quadrature y counts not yet emitted
+static uint8_t quad_xphase;                 ///< current x quadrature phase, 0..3
+static uint8_t quad_yphase;                 ///< current y quadrature phase, 0..3
+static uint8_t quad_xlines[4];              ///< JOYDDR bits pulled low in every x phase
+static uint8_t quad_ylines[4];              ///< JOYDDR bits pulled low in every y phase
+static volatile uint8_t quad_fire;          ///< JOYDDR bit for left button, or 0
+
+/// NEOS read sequence: four nibbles and the deltas they carry
+typedef struct _neosframe {
+    uint8_t lines[4];                       ///< JOYDDR images of XH, XL, YH, YL
+    int8_t dx;                              ///< x delta
+    int8_t dy;                              ///< y delta
+} NeosFrame;
+
+static NeosFrame neos[2];                   ///< image being read and the next one
+static NeosFrame neos_none;                 ///< image without deltas
+static NeosFrame * volatile neos_cur;       ///< image the C64 is reading
+static NeosFrame * volatile neos_next;      ///< image to read after this sequence, or 0
+static volatile uint8_t neos_fire;          ///< JOYDDR bit for left button, or 0
+static uint8_t neos_step;                   ///< nibble on the lines, 0..3
+static uint8_t neos_strobe;                 ///< last seen strobe level, 1 = high
+static int16_t neos_x;                      ///< x movement not in an image yet
+static int16_t neos_y;                      ///< y movement not in an image yet
+
+STATIC_ASSERT(T1_US(NEOS_TIMEOUT_US) >= 2 && T1_US(NEOS_TIMEOUT_US) <= 65536UL, neos_timeout_unrepresentable);
+
+/// All joystick lines
+#define JOY_LINES   (_BV(JOYFIRE) | _BV(JOYUP) | _BV(JOYDOWN) | _BV(JOYLEFT) | _BV(JOYRIGHT))
+
+/// Both pot lines
+#define POT_LINES   (_BV(POTX) | _BV(POTY))
+
+/// Backlog saturation, counts
+#define QUAD_BACKLOG_MAX    30000
+
+#define KOALA_MIN   4       ///< Lowest value a real KoalaPad reports
+#define KOALA_MAX   251     ///< Highest value a real KoalaPad reports while touched
+
+STATIC_ASSERT(T1_HZ / QUAD_EDGE_HZ_MAX >= 16, quadrature_edge_rate_too_high_for_timer1);
+STATIC_ASSERT(T1_HZ / 100 <= 65536UL, quadrature_edge_rate_unrepresentable);
+
+/// Timer1 ticks per 1351 count at prescaler p, 8.8 fixed point. 
+/// Scale should be 2us per count, but for this particular chip, 66 counts work better where
+/// 64 counts should be. So 66/64=100/96 and times two.
+#define POT_STEP_Q8(p)  ((uint16_t)((200ULL * ((F_CPU)/(p)) * 256 / 96 + 500000) / 1000000))
+
+/// Timer1 ticks per SID pot value at prescaler p, 8.8 fixed point: a 1351 count is two pot values
+#define POT_UNIT_Q8(p)  (POT_STEP_Q8(p) / 2)
+
+/// SID value at zero point: 1351 counter 0 reads as 64
+#define POT_ZERO_VALUE  64
+
+/// Length of SID measurement cycle, 512 phi2 clocks at PAL 985248 Hz
+#define SID_CYCLE_US    519
+
+/// \brief Pot timing constraints at Timer1 prescaler p.
+///
+/// Whole SID measurement cycle must fit into Timer1. Every pot value must land on 
+/// its own Timer1 tick, rounding error is then within half a tick. 
+/// Values 0..254 must produce an edge within the SID cycle at default zero point,
+/// 255 is what SID reads when the edge misses the cycle.
+#define POT_TIMING_CHECK(p, tag) \
+    STATIC_ASSERT(TIMER_TICKS(SID_CYCLE_US, p) < 65536UL, sid_cycle_exceeds_timer1_range_##tag); \
+    STATIC_ASSERT(POT_UNIT_Q8(p) >= 256, pot_value_below_timer1_resolution_##tag); \
+    STATIC_ASSERT(TIMER_TICKS(320, p) + (((254UL - POT_ZERO_VALUE) * POT_UNIT_Q8(p) + 128) >> 8) \
+                  < TIMER_TICKS(SID_CYCLE_US, p), pot_full_range_exceeds_sid_cycle_##tag); \
+    STATIC_ASSERT(TIMER_TICKS(320, p) > ((POT_ZERO_VALUE * POT_UNIT_Q8(p) + 128) >> 8), \
+                  pot_zero_value_before_cycle_start_##tag); \
+    STATIC_ASSERT(((F_CPU)/(p)) % 100000UL == 0 && ((F_CPU)/(p)) / 100000UL < 256, \
+                  timer1_ticks_per_10us_unrepresentable_##tag)
+
+POT_TIMING_CHECK(T1_PRESCALER, lores);
+POT_TIMING_CHECK(1, hires);
+
+/// Timer1 value for SID pot value v
+#define POT_VALUE_OCR(v) (ocr_base + (uint16_t)(((uint32_t)(v) * pot_unit_q8 + 128) >> 8))
+
 void potmouse_init() {
     // Joystick outputs, all to Z and no pullup
-    JOYPORT &= ~(_BV(JOYFIRE) | _BV(JOYUP) | _BV(JOYDOWN) | _BV(JOYLEFT) | _BV(JOYRIGHT)); 
-    JOYDDR  &= ~(_BV(JOYFIRE) | _BV(JOYUP) | _BV(JOYDOWN) | _BV(JOYLEFT) | _BV(JOYRIGHT));
+    JOYPORT &= ~JOY_LINES; 
+    JOYDDR  &= ~JOY_LINES;
     
     // SID sensing port
     SENSEDDR  &= ~_BV(POTSENSE); // SENSE is input
     SENSEPORT &= ~_BV(POTSENSE); // pullup off, hi-biased by OC1B
 
     // SID POTX/POTY port
-    POTPORT &= ~(_BV(POTX) | _BV(POTY));
-    POTDDR  &= ~(_BV(POTX) | _BV(POTY));
+    POTPORT &= ~POT_LINES;
+    POTDDR  &= ~POT_LINES;
 
     // prepare INT1
-    GICR &= ~_BV(INT1);                     // disable INT1
+    IO_CLR(GICR, _BV(INT1));                // disable INT1
     MCUCR &= ~(_BV(ISC11)|_BV(ISC10));  
     MCUCR |= _BV(ISC11);                    // ISC11:ISC10 == 10, @negedge   
     
     mode = POTMOUSE_C1351;
+    potmouse_hires(0);
+}
+
+/// \brief Fill quadrature phase tables.
+///
+/// Phases follow Gray code 00, 10, 11, 01 for (A, B). A line is pulled low
+/// (DDR bit set) when its level in the phase is 0.
+static void quad_setlines(uint8_t *lines, uint8_t a, uint8_t b) {
+    lines[0] = a | b;
+    lines[1] = b;
+    lines[2] = 0;
+    lines[3] = a;
+}
+
+/// \brief Fill button tables for the mode.
+/// \param left JOYDDR bit for left button
+/// \param right JOYDDR bit for right button
+/// \param middle JOYDDR bit for middle button
+/// \param pright POTDDR bit for right button
+/// \param pmiddle POTDDR bit for middle button
+static void btn_setlines(uint8_t left, uint8_t right, uint8_t middle, uint8_t pright, uint8_t pmiddle) {
+    uint8_t b;
+    
+    for (b = 0; b < 8; b++) {
+        btn_joy[b] = ((b & 001) ? left : 0) | ((b & 002) ? right : 0) | ((b & 004) ? middle : 0);
+        btn_pot[b] = ((b & 002) ? pright : 0) | ((b & 004) ? pmiddle : 0);
+    }
+}
+
+/// \brief Compose output image with given OCR values and current buttons, publish it for INT1.
+static void frame_put(uint16_t a, uint16_t b) {
+    PotFrame *f = &frames[frame_front ^ 1];
+    
+    f->ocr1a = a;
+    f->ocr1b = b;
+    f->joyddr = joy_keep | joy_buttons;
+    
+    frame_a = a;
+    frame_b = b;
+    
+    // single byte write, INT1 sees either image complete; the image stores
+    // must not be moved past it
+    RING_BARRIER();
+    frame_front ^= 1;
+}
+
+/// \brief Add movement to quadrature backlog and kick the edge timer.
+static void quad_movt(int16_t dx, int16_t dy) {
+    int16_t x, y;
+    
+    IO_CLR(TIMSK, _BV(OCIE1A));
+    
+    x = quad_xbacklog + dx;
+    y = quad_ybacklog - dy;     // PS/2 y grows up, Amiga/ST y grows down
+    if (x > QUAD_BACKLOG_MAX) x = QUAD_BACKLOG_MAX;
+    if (x < -QUAD_BACKLOG_MAX) x = -QUAD_BACKLOG_MAX;
+    if (y > QUAD_BACKLOG_MAX) y = QUAD_BACKLOG_MAX;
+    if (y < -QUAD_BACKLOG_MAX) y = -QUAD_BACKLOG_MAX;
+    quad_xbacklog = x;
+    quad_ybacklog = y;
+    
+    // button may have changed without movement
+    JOYDDR = joy_keep | quad_xlines[quad_xphase & 3] | quad_ylines[quad_yphase & 3] | quad_fire;
+    
+    IO_SET(TIMSK, _BV(OCIE1A));
+}
+
+/// \brief JOYDDR bits for a NEOS nibble: a 1 bit pulls its line low.
+static uint8_t neos_lines(uint8_t n) {
+    return ((n & 1) ? _BV(JOYUP) : 0) | ((n & 2) ? _BV(JOYDOWN) : 0) | 
+           ((n & 4) ? _BV(JOYLEFT) : 0) | ((n & 8) ? _BV(JOYRIGHT) : 0);
+}
+
+/// \brief Limit NEOS backlog to what fits into one image.
+/// \param d backlog, updated
+/// \return delta to send
+static int8_t neos_take(int16_t *d) {
+    int16_t v = *d;
+    
+    if (v > 127) v = 127;
+    if (v < -128) v = -128;
+    *d -= v;
+    
+    return (int8_t)v;
+}
+
+/// \brief Show the left button at once, the strobe handler keeps it.
+static void neos_button(uint8_t fire) {
+    uint8_t sreg = SREG;
+    
+    cli();
+    neos_fire = fire;
+    JOYDDR = neos_cur->lines[neos_step] | fire;
+    SREG = sreg;
+}
+
+/// \brief Add movement to NEOS backlog and publish the next image.
+static void neos_movt(int16_t dx, int16_t dy) {
+    NeosFrame *f, *cur;
+    int16_t x, y;
+    uint8_t sreg;
+    
+    // take back the image that isn't being read yet, its deltas go into the new one;
+    // only the pointers under cli, the strobe interrupt waits for this
+    sreg = SREG;
+    cli();
+    f = neos_next;
+    neos_next = 0;
+    cur = neos_cur;
+    SREG = sreg;
+    // without a next image the handler can only switch to neos_none
+    if (!f) {
+        f = (cur == &neos[0]) ? &neos[1] : &neos[0];
+        f->dx = f->dy = 0;
+    }
+    
+    x = neos_x - dx + f->dx;    // NEOS x grows to the left
+    y = neos_y + dy + f->dy;
+    if (x > QUAD_BACKLOG_MAX) x = QUAD_BACKLOG_MAX;
+    if (x < -QUAD_BACKLOG_MAX) x = -QUAD_BACKLOG_MAX;
+    if (y > QUAD_BACKLOG_MAX) y = QUAD_BACKLOG_MAX;
+    if (y < -QUAD_BACKLOG_MAX) y = -QUAD_BACKLOG_MAX;
+    
+    f->dx = neos_take(&x);
+    f->dy = neos_take(&y);
+    neos_x = x;
+    neos_y = y;
+    
+    f->lines[0] = joy_keep | neos_lines((uint8_t)f->dx >> 4);
+    f->lines[1] = joy_keep | neos_lines((uint8_t)f->dx);
+    f->lines[2] = joy_keep | neos_lines((uint8_t)f->dy >> 4);
+    f->lines[3] = joy_keep | neos_lines((uint8_t)f->dy);
+    
+    sreg = SREG;
+    cli();
+    neos_next = f;
+    SREG = sreg;
+}
+
+/// \brief Integrate movement into absolute position.
+/// \param pos position, 12.4 fixed point
+/// \param d movement in counts
+/// \return new position clamped to abs_min..abs_max
+static int16_t abs_integrate(int16_t pos, int16_t d) {
+    int32_t p = (int32_t)pos + (int32_t)d * abs_gain;
+    
+    if (p < abs_min) p = abs_min;
+    if (p > abs_max) p = abs_max;
+    
+    return (int16_t)p;
+}
+
+void potmouse_gain(uint8_t gain) {
+    abs_gain = gain;
+}
+
+void potmouse_clamp(uint8_t min, uint8_t max) {
+    abs_min = (int16_t)min << 4;
+    abs_max = (int16_t)max << 4;
+}
+
+/// \brief Calculate OCR1A/OCR1B values for given 1351 counters.
+static void potmouse_load(uint8_t x, uint8_t y) {
+    uint16_t a, b;
+    
+    a = ocr_zero + (uint16_t)(((uint32_t)(y & 077) * pot_step_q8 + 128) >> 8);
+    b = ocr_zero + (uint16_t)(((uint32_t)(x & 077) * pot_step_q8 + 128) >> 8);
+    
+    frame_put(a, b);
+}
+
+/// \brief Velocity estimate from reported movement.
+/// \param d movement in counts
+/// \param n SID cycles since previous report
+/// \return counts per SID cycle, 8.8 fixed point
+static int16_t pred_velocity(int16_t d, uint8_t n) {
+    int32_t v = ((int32_t)d << 8) / n;
+    
+    // 128 counts or more in one cycle don't fit 8.8
+    if (v > INT16_MAX) return INT16_MAX;
+    if (v < INT16_MIN) return INT16_MIN;
+    return (int16_t)v;
+}
+
+/// \brief Update velocity estimate on every report in proportional mode.
+static void pred_report(int16_t dx, int16_t dy) {
+    uint8_t now = sid_cycles;
+    uint8_t n = pred_age;
+    
+    pred_age = 0;
+    
+    if (!pred_active || n == 0 || n > PRED_MAX_GAP) {
+        // first report after a pause: nothing to extrapolate from yet
+        pred_vx = pred_vy = 0;
+        pred_span = PRED_MAX_GAP / 2;
+    } else {
+        pred_vx = pred_velocity(dx, n);
+        pred_vy = pred_velocity(dy, n);
+        pred_span = n;
+    }
+    
+    pred_seen = now;
+    pred_active = 1;
+    pred_held = 0;
+}
+
+void potmouse_predict(uint8_t on) {
+    pred_on = on;
+    pred_active = 0;
+}
+
+void potmouse_poll() {
+    uint8_t now = sid_cycles;
+    uint16_t k;
+    uint8_t sreg;
+    
+    if (mode == POTMOUSE_NEOS) {
+        if (TIFR & _BV(OCF1A)) {
+            // no strobe edge for NEOS_TIMEOUT_US: a sequence the C64 gave up in
+            // the middle is shown again from the start, with the same deltas
+            sreg = SREG;
+            cli();
+            if (TIFR & _BV(OCF1A)) {
+                TIFR = _BV(OCF1A);
+                if (neos_step) {
+                    neos_step = 0;
+                    JOYDDR = neos_cur->lines[0] | neos_fire;
+                }
+            }
+            SREG = sreg;
+        }
+        
+        // backlog larger than one image goes out without further movement
+        if ((neos_x | neos_y) && !neos_next) neos_movt(0, 0);
+        return;
+    }
+    
+    if (mode != POTMOUSE_C1351 || !pred_on || !pred_active || pred_held || now == pred_seen) return;
+    
+    pred_seen = now;
+    
+    // position due at the next SID sample; the age doesn't wrap, so after a long
+    // stall this holds the pointer instead of starting the prediction over
+    k = pred_age + 1;
+    if (k >= pred_span) {
+        // one report interval is up: hold the pointer where it is instead of walking
+        // it back, the next report brings only what is left after the extrapolation
+        pred_owe_x = (int8_t)(((int32_t)pred_vx * pred_span) >> 8);
+        pred_owe_y = (int8_t)(((int32_t)pred_vy * pred_span) >> 8);
+        potmouse_xcounter = (potmouse_xcounter + pred_owe_x) & 077;
+        potmouse_ycounter = (potmouse_ycounter + pred_owe_y) & 077;
+        pred_held = 1;
+        potmouse_load(potmouse_xcounter, potmouse_ycounter);
+        return;
+    }
+    
+    potmouse_load(potmouse_xcounter + (int8_t)(((int32_t)pred_vx * k) >> 8),
+                  potmouse_ycounter + (int8_t)(((int32_t)pred_vy * k) >> 8));
+}
+
+void potmouse_edgerate(uint16_t hz) {
+    if (hz > QUAD_EDGE_HZ_MAX) hz = QUAD_EDGE_HZ_MAX;
+    if (hz < 100) hz = 100;
+    OCR1A = (uint16_t)(T1_HZ / hz - 1);
+}
+
+uint8_t potmouse_cycles() {
+    return sid_cycles;
 }
 
 void potmouse_start(uint8_t m) {
     mode = m;
+    
+    // quiesce whatever engine was running before; the comparator interrupt goes
+    // off before the comparator does, or switching it off could raise one
+    IO_CLR(GICR, _BV(INT1));
+    IO_CLR(TIMSK, _BV(TOIE1) | _BV(OCIE1A) | _BV(OCIE1B));
+    TCCR1B = 0;
+    TCCR1A = 0;
+    ACSR = 0;
+    ACSR = _BV(ACD) | _BV(ACI);
+    SFIOR &= ~_BV(ACME);
+    
+    // release all lines, buttons follow with the next report
+    joy_keep = JOYDDR & ~JOY_LINES;
+    pot_keep = POTDDR & ~POT_LINES;
+    joy_buttons = 0;
+    JOYDDR = joy_keep;
+    
     switch (mode) {
+        case POTMOUSE_C1351:
+            btn_setlines(_BV(JOYFIRE), _BV(JOYUP), _BV(JOYDOWN), 0, 0);
+            break;
+        case POTMOUSE_PADDLE:
+        case POTMOUSE_KOALA:
+            btn_setlines(_BV(JOYLEFT), _BV(JOYRIGHT), 0, 0, 0);
+            break;
+        case POTMOUSE_JOYSTICK:
+        case POTMOUSE_ATARIST:
+        case POTMOUSE_NEOS:
+            btn_setlines(_BV(JOYFIRE), 0, 0, _BV(POTX), 0);
+            break;
+        case POTMOUSE_AMIGA:
+            btn_setlines(_BV(JOYFIRE), 0, 0, _BV(POTX), _BV(POTY));
+            break;
+    }
+    
+    switch (mode) {
+        case POTMOUSE_PADDLE:
+        case POTMOUSE_KOALA:
+            // start in the middle of the range
+            if (mode == POTMOUSE_PADDLE) {
+                potmouse_clamp(0, 255);
+            } else {
+                potmouse_clamp(KOALA_MIN, KOALA_MAX);
+            }
+            abs_x = abs_y = (abs_min + abs_max) / 2;
+            frame_put(POT_VALUE_OCR(abs_y >> 4), POT_VALUE_OCR(abs_x >> 4));
+            // timing is the same as in proportional mode
+            // fall through
         case POTMOUSE_C1351:
             // Initialize Timer1 and use OC1A/OC1B to output values
             // don't count yet    
             TCCR1B = 0; 
             
+            // output image in the middle of the range and no buttons,
+            // counter 0 would be pot value 64, the bottom edge
+            if (mode == POTMOUSE_C1351) {
+                potmouse_xcounter = potmouse_ycounter = 040;
+                pred_owe_x = pred_owe_y = 0;
+                potmouse_load(potmouse_xcounter, potmouse_ycounter);
+            }
+            
             // POTX/Y normally controlled by output compare unit
             // initially should be pulled up to provide high bias on SENSE pin
-            POTDDR  |= _BV(POTX) | _BV(POTY);   // enable POTX/POTY as outputs
-            POTPORT |= _BV(POTX) | _BV(POTY);   // output "1" on both
+            POTDDR  = pot_keep | POT_LINES;     // enable POTX/POTY as outputs
+            POTPORT |= POT_LINES;               // output "1" on both
             
-            GIFR |= _BV(INTF1);                     // clear INT1 flag
-            GICR |= _BV(INT1);                      // enable INT1
+            GIFR = _BV(INTF1);                      // clear INT1 flag
+            IO_SET(GICR, _BV(INT1));                // enable INT1
             break;
         case POTMOUSE_JOYSTICK:
             // Joystick emulation
             // close directional pins for ~20ms while there is movement
             TCCR1B = 0;
             TCCR1A = 0;
+            POTPORT &= ~POT_LINES;
+            POTDDR  = pot_keep;
+            joy_rest = joy_keep;
+            pot_rest = pot_keep;
+            
+            break;
+        case POTMOUSE_AMIGA:
+        case POTMOUSE_ATARIST:
+            // Quadrature emulation
+            // all lines open collector: DDR set pulls the line low
+            POTPORT &= ~POT_LINES;
+            POTDDR  = pot_keep;
+            JOYPORT &= ~JOY_LINES;
+            
+            if (mode == POTMOUSE_AMIGA) {
+                quad_setlines(quad_xlines, _BV(JOYDOWN), _BV(JOYRIGHT));    // H, HQ
+                quad_setlines(quad_ylines, _BV(JOYUP), _BV(JOYLEFT));       // V, VQ
+                potmouse_edgerate(QUAD_AMIGA_EDGE_HZ);
+            } else {
+                quad_setlines(quad_xlines, _BV(JOYDOWN), _BV(JOYUP));       // XA, XB
+                quad_setlines(quad_ylines, _BV(JOYLEFT), _BV(JOYRIGHT));    // YA, YB
+                potmouse_edgerate(QUAD_ATARIST_EDGE_HZ);
+            }
+            quad_xphase = quad_yphase = 2;  // all lines released
+            quad_xbacklog = quad_ybacklog = 0;
+            quad_fire = 0;
+            
+            // Timer1 in CTC mode, TOP = OCR1A, clk/T1_PRESCALER
+            TCNT1 = 0;
+            TIFR = _BV(OCF1A);
+            TCCR1B = _BV(WGM12) | T1_CS;
+            break;
+        case POTMOUSE_NEOS:
+            // nibbles on UP/DOWN/LEFT/RIGHT, open collector, strobe sensed on FIRE
+            POTPORT &= ~POT_LINES;
+            POTDDR  = pot_keep;
+            JOYPORT &= ~JOY_LINES;
             
+            neos_x = neos_y = 0;
+            neos_none.lines[0] = neos_none.lines[1] = neos_none.lines[2] = neos_none.lines[3] = joy_keep;
+            neos_cur = &neos_none;
+            neos_next = 0;
+            neos_fire = 0;
+            neos_step = 0;
+            neos_strobe = (JOYPIN & _BV(JOYFIRE)) ? 1 : 0;
+            JOYDDR = neos_cur->lines[0];
+            
+            // Timer1 in CTC mode, TOP = OCR1A, no interrupt: the compare flag
+            // marks a sequence abandoned, see potmouse_poll()
+            OCR1A = (uint16_t)(T1_US(NEOS_TIMEOUT_US) - 1);
+            TCNT1 = 0;
+            TIFR = _BV(OCF1A);
+            TCCR1B = _BV(WGM12) | T1_CS;
+            
+            // strobe edges through the comparator: ADC off, FIRE on the negative
+            // input, bandgap on the positive one, interrupt on both edges
+            ADCSRA = 0;
+            ADMUX = JOYFIRE_MUX;
+            SFIOR |= _BV(ACME);
+            ACSR = _BV(ACBG);
+            ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIE);
             break;
     }
 }
 
 void potmouse_movt(int16_t dx, int16_t dy, uint8_t button) {
-    uint16_t a, b;
+    button &= 7;
+    joy_buttons = btn_joy[button];
     
     switch (mode) {
         case POTMOUSE_C1351:
-            potmouse_xcounter = (potmouse_xcounter + dx) & 077; // modulo 64
-            potmouse_ycounter = (potmouse_ycounter + dy) & 077;
-        
-            (button & 001) ? (JOYDDR |= _BV(JOYFIRE)) : (JOYDDR &= ~_BV(JOYFIRE));
-            (button & 002) ? (JOYDDR |= _BV(JOYUP))   : (JOYDDR &= ~_BV(JOYUP));
-            (button & 004) ? (JOYDDR |= _BV(JOYDOWN)) : (JOYDDR &= ~_BV(JOYDOWN));
-            
-            // scale should be 2x here, but for this particular chip, 66 counts work better where
-            // 64 counds should be. so 66/64=100/96 and times two
-            a = ocr_zero + potmouse_ycounter*200/96;
-            b = ocr_zero + potmouse_xcounter*200/96;
+            // counts held from the extrapolation are on the lines already
+            potmouse_xcounter = (potmouse_xcounter + dx - pred_owe_x) & 077; // modulo 64
+            potmouse_ycounter = (potmouse_ycounter + dy - pred_owe_y) & 077;
+            pred_owe_x = pred_owe_y = 0;
             
-            ocr1a_load = a;
-            ocr1b_load = b;
+            if (pred_on) pred_report(dx, dy);
+            potmouse_load(potmouse_xcounter, potmouse_ycounter);
             break;
         case POTMOUSE_JOYSTICK:
-            JOYDDR  &= ~(_BV(JOYFIRE) | _BV(JOYUP) | _BV(JOYDOWN) | _BV(JOYLEFT) | _BV(JOYRIGHT));
-
-            (dx < 0) ? (JOYDDR |= _BV(JOYLEFT)) : (JOYDDR &= ~_BV(JOYLEFT));
-            (dx > 0) ? (JOYDDR |= _BV(JOYRIGHT)): (JOYDDR &= ~_BV(JOYRIGHT));
-            (dy < 0) ? (JOYDDR |= _BV(JOYDOWN)) : (JOYDDR &= ~_BV(JOYDOWN));
-            (dy > 0) ? (JOYDDR |= _BV(JOYUP))   : (JOYDDR &= ~_BV(JOYUP));
-            (button & 001) ? (JOYDDR |= _BV(JOYFIRE)) : (JOYDDR &= ~_BV(JOYFIRE));
-            (button & 002) ? (POTDDR |= _BV(POTX)) : (POTDDR &= ~_BV(POTX));
+            // buttons stay after the pulse, directions don't
+            IO_CLR(TIMSK, _BV(TOIE1));
+            joy_rest = joy_keep | joy_buttons;
+            pot_rest = pot_keep | btn_pot[button];
+            JOYDDR = joy_rest | dir_x[(dx > 0) - (dx < 0) + 1] | dir_y[(dy > 0) - (dy < 0) + 1];
+            POTDDR = pot_rest;
   
             TCNT1 = 65535-256;
             TCCR1A = 0;
             TCCR1B = _BV(CS12)|_BV(CS10);
-            TIFR |= _BV(TOV1);
-            TIMSK |= _BV(TOIE1);
+            TIFR = _BV(TOV1);
+            IO_SET(TIMSK, _BV(TOIE1));
+            break;
+        case POTMOUSE_PADDLE:
+        case POTMOUSE_KOALA:
+            // paddle: turning right lowers the value
+            // KoalaPad: origin in top left corner
+            abs_x = abs_integrate(abs_x, mode == POTMOUSE_PADDLE ? -dx : dx);
+            abs_y = abs_integrate(abs_y, -dy);
+            
+            frame_put(POT_VALUE_OCR(abs_y >> 4), POT_VALUE_OCR(abs_x >> 4));
+            break;
+        case POTMOUSE_AMIGA:
+        case POTMOUSE_ATARIST:
+            quad_fire = joy_buttons;
+            POTDDR = pot_keep | btn_pot[button];
+            
+            quad_movt(dx, dy);
+            break;
+        case POTMOUSE_NEOS:
+            neos_button(joy_buttons);
+            POTDDR = pot_keep | btn_pot[button];
+            
+            neos_movt(dx, dy);
+            break;
+    }
+}
+
+void potmouse_buttons(uint8_t button) {
+    uint8_t pulse, sreg;
+    
+    button &= 7;
+    joy_buttons = btn_joy[button];
+    
+    switch (mode) {
+        case POTMOUSE_C1351:
+        case POTMOUSE_PADDLE:
+        case POTMOUSE_KOALA:
+            // same position, INT1 commits the buttons at the start of the next cycle
+            frame_put(frame_a, frame_b);
+            break;
+        case POTMOUSE_JOYSTICK:
+            // a pulse in progress keeps its directions and ends with the new buttons;
+            // the overflow handler clears TOIE1 too, so test and clear in one go
+            sreg = SREG;
+            cli();
+            pulse = TIMSK & _BV(TOIE1);
+            TIMSK &= ~_BV(TOIE1);
+            SREG = sreg;
+            JOYDDR = (pulse ? JOYDDR & ~joy_rest : 0) | joy_keep | joy_buttons;
+            joy_rest = joy_keep | joy_buttons;
+            pot_rest = pot_keep | btn_pot[button];
+            POTDDR = pot_rest;
+            if (pulse) IO_SET(TIMSK, _BV(TOIE1));
+            break;
+        case POTMOUSE_AMIGA:
+        case POTMOUSE_ATARIST:
+            quad_fire = joy_buttons;
+            POTDDR = pot_keep | btn_pot[button];
+            
+            quad_movt(0, 0);
+            break;
+        case POTMOUSE_NEOS:
+            neos_button(joy_buttons);
+            POTDDR = pot_keep | btn_pot[button];
             break;
     }
 }
 
 void potmouse_zero(uint16_t zero) {
-    ocr_zero = zero;
+    zero_us = zero;
+    ocr_zero = (uint16_t)((uint32_t)zero * t1_per_10us / 10);
+    ocr_base = ocr_zero - (uint16_t)(((uint32_t)POT_ZERO_VALUE * pot_unit_q8 + 128) >> 8);
+}
+
+void potmouse_hires(uint8_t on) {
+    uint8_t int1 = GICR & _BV(INT1);
+    
+    // INT1 reads all of these
+    IO_CLR(GICR, _BV(INT1));
+    
+    if (on) {
+        t1_cs = T1_CS_HIRES;
+        pot_step_q8 = POT_STEP_Q8(1);
+        pot_unit_q8 = POT_UNIT_Q8(1);
+        t1_per_10us = (F_CPU) / 100000UL;
+    } else {
+        t1_cs = T1_CS;
+        pot_step_q8 = POT_STEP_Q8(T1_PRESCALER);
+        pot_unit_q8 = POT_UNIT_Q8(T1_PRESCALER);
+        t1_per_10us = T1_HZ / 100000UL;
+    }
+    potmouse_zero(zero_us);
+    
+    // rescale current output
+    switch (mode) {
+        case POTMOUSE_C1351:
+            potmouse_load(potmouse_xcounter, potmouse_ycounter);
+            break;
+        case POTMOUSE_PADDLE:
+        case POTMOUSE_KOALA:
+            frame_put(POT_VALUE_OCR(abs_y >> 4), POT_VALUE_OCR(abs_x >> 4));
+            break;
+    }
+    
+    GIFR = _BV(INTF1);
+    if (int1) IO_SET(GICR, _BV(INT1));
 }
 
 /// SID measuring cycle detected.
@@ -127,16 +805,19 @@ void potmouse_zero(uint16_t zero) {
 /// 3. SID releases POTX\n
 /// 4. 0 to 255 cycles until the cap is charged\n
 ///
-/// This handler stops the Timer1, clears OC1A/OC1B outputs,
-/// loads the timer with values precalculated in potmouse_movt()
-/// and starts the timer. 
+/// This handler stops the Timer1, clears OC1A/OC1B outputs
+/// and starts the timer. Then it commits the output image published by the main
+/// loop: OCR values and buttons. Compare match is hundreds of us away, so
+/// loading OCR1A/OCR1B after the start is safe and keeps the start latency short.
 ///
 /// OC1A/OC1B (YPOT/XPOT) lines will go up by hardware. 
-/// Normal SID cycle is 512us. Timer will overflow not before 65535us.
+/// Normal SID cycle is 512us. Timer will overflow not before 65536 counts.
 /// Next cycle will begin before that so there's no need to stop the timer.
 /// Output compare match interrupts are thus not used.
 
 ISR(INT1_vect) {
+    PotFrame *f;
+    
     // SID started to measure the pots, uuu
 
     // disable INT1 until the measurement cycle is complete
@@ -156,21 +837,92 @@ ISR(INT1_vect) {
     // load the timer 
     TCNT1 = 0;
     
-    // init the output compare values 
-    OCR1A = ocr1a_load;
-    OCR1B = ocr1b_load;
+    // start timer at clk/T1_PRESCALER or, in high resolution mode, clk/1
+    TCCR1B = t1_cs;  
     
-    // start timer with prescaler clk/8 (1 count = 1us)
-    TCCR1B = _BV(CS11);  
+    // timing critical part is over, commit the output image
+    f = &frames[frame_front];
+    RING_BARRIER();
+    OCR1A = f->ocr1a;
+    OCR1B = f->ocr1b;
+    JOYDDR = f->joyddr;
+    
+    // count the cycle for motion prediction
+    sid_cycles++;
+    if (pred_age != 0xff) pred_age++;
 }
 
 /// TIMER1 Overflow vector
 ///
-/// Ends joystick emulator pulse.
+/// Ends joystick emulator pulse: directions are released, buttons stay.
 ISR(TIMER1_OVF_vect) {
-    JOYDDR  &= ~(_BV(JOYFIRE) | _BV(JOYUP) | _BV(JOYDOWN) | _BV(JOYLEFT) | _BV(JOYRIGHT));
-    POTDDR  &= ~_BV(POTX);
+    JOYDDR = joy_rest;
+    POTDDR = pot_rest;
     TIMSK &= ~_BV(TOIE1);
 }
 
+/// TIMER1 Compare A vector
+///
+/// Quadrature edge tick. Steps every axis with nonzero backlog by one phase
+/// and writes all joystick lines at once. Stops itself when there's nothing left to emit.
+ISR(TIMER1_COMPA_vect) {
+    int16_t x = quad_xbacklog;
+    int16_t y = quad_ybacklog;
+    
+    if (x > 0) {
+        quad_xphase++;
+        x--;
+    } else if (x < 0) {
+        quad_xphase--;
+        x++;
+    }
+    
+    if (y > 0) {
+        quad_yphase++;
+        y--;
+    } else if (y < 0) {
+        quad_yphase--;
+        y++;
+    }
+    
+    quad_xbacklog = x;
+    quad_ybacklog = y;
+    
+    JOYDDR = joy_keep | quad_xlines[quad_xphase & 3] | quad_ylines[quad_yphase & 3] | quad_fire;
+    
+    if (x == 0 && y == 0) {
+        TIMSK &= ~_BV(OCIE1A);
+    }
+}
+/// Analog Comparator vector
+///
+/// NEOS strobe edge. On an edge of the expected direction steps to the next nibble.
+/// At the end of a sequence takes the next image if the main loop published one,
+/// otherwise the image without deltas. Every edge restarts the abandon timeout.
+ISR(ANA_COMP_vect) {
+    // FIRE below the bandgap: strobe low
+    uint8_t s = (ACSR & _BV(ACO)) ? 0 : 1;
+    uint8_t step = neos_step;
+    
+    // noise around the threshold may interrupt twice for one edge
+    if (s == neos_strobe) return;
+    neos_strobe = s;
+    
+    // rising edge leads to XL or YL, falling edge to YH or the next XH
+    if (!(step & 1) != !s) {
+        step = (step + 1) & 3;
+        if (step == 0) {
+            // deltas are delivered
+            NeosFrame *f = neos_next;
+            neos_cur = f ? f : &neos_none;
+            neos_next = 0;
+        }
+        neos_step = step;
+        JOYDDR = neos_cur->lines[step] | neos_fire;
+    }
+    
+    TCNT1 = 0;
+    TIFR = _BV(OCF1A);
+}
+
 //$Id$
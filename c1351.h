@@ -8,14 +8,37 @@
 
 #include <inttypes.h>
 
-/// Mouse mode: 1351 (analog, proportional) or joystick 
+/// Mouse mode: 1351 (analog, proportional), joystick, quadrature, absolute or NEOS
 ///
 /// See potmouse_start()
 enum _potmode {
     POTMOUSE_C1351 = 0,             //<! proportional mode
-    POTMOUSE_JOYSTICK               //<! joystick mode
+    POTMOUSE_JOYSTICK,              //<! joystick mode
+    POTMOUSE_AMIGA,                 //<! Amiga quadrature mouse
+    POTMOUSE_ATARIST,               //<! Atari ST quadrature mouse
+    POTMOUSE_PADDLE,                //<! absolute position, paddle pair
+    POTMOUSE_KOALA,                 //<! absolute position, KoalaPad tablet
+    POTMOUSE_NEOS,                  //<! NEOS mouse, nibbles strobed by the C64
 };
 
+/// Default absolute mode gain: 1/16ths of a pot unit per mouse count
+#define POTMOUSE_GAIN_DEFAULT   16
+
+/// Default maximal quadrature edge rate per axis for Amiga, Hz.
+/// Amiga software reads its 8-bit counters once per frame, 127 counts per frame at 50Hz
+/// is the limit before the counter wraps ambiguously.
+#define QUAD_AMIGA_EDGE_HZ  6000
+
+/// Default maximal quadrature edge rate per axis for Atari ST, Hz.
+/// IKBD polls the mouse lines in software, this is what it reliably follows.
+#define QUAD_ATARIST_EDGE_HZ 4000
+
+/// Upper limit for potmouse_edgerate()
+#define QUAD_EDGE_HZ_MAX    20000
+
+/// NEOS read sequence is abandoned after this long without a strobe edge, us
+#define NEOS_TIMEOUT_US     500
+
 /// Init all C1351-related I/O and interrupts, but don't start yet.
 void potmouse_init();
 
@@ -26,9 +49,43 @@ void potmouse_start(uint8_t mode);
 /// Report movement from PS2 mouse.
 void potmouse_movt(int16_t dx, int16_t dy, uint8_t button);
 
-/// Define zero-point in time (normally 320us)
+/// \brief Report buttons ahead of the movement that comes with them.
+/// Outputs follow as they would for potmouse_movt(0, 0, button), without counting a report.
+/// \param button bits 2,1,0 == middle,right,left
+void potmouse_buttons(uint8_t button);
+
+/// \brief Enable or disable motion prediction in proportional mode.
+/// \param on 1 = extrapolate position between PS/2 reports
+void potmouse_predict(uint8_t on);
+
+/// Update predicted position. Call from main loop as often as possible.
+void potmouse_poll();
+
+/// Define zero-point in time, in microseconds (normally 320us)
 void potmouse_zero(uint16_t zero);
 
+/// \brief Select pot edge timing resolution in proportional, paddle and KoalaPad modes.
+/// \param on 0 = Timer1 at clk/T1_PRESCALER, 1 = Timer1 at clk/1
+void potmouse_hires(uint8_t on);
+
+/// \brief Set gain of absolute position modes (paddle, KoalaPad).
+/// \param gain pot units per mouse count, 4.4 fixed point (16 = 1:1)
+void potmouse_gain(uint8_t gain);
+
+/// \brief Limit absolute position range in paddle and KoalaPad modes.
+/// Mode defaults are set by potmouse_start().
+/// \param min lowest pot value
+/// \param max highest pot value
+void potmouse_clamp(uint8_t min, uint8_t max);
+
+/// \brief Set maximal quadrature edge rate per axis in Amiga/Atari ST modes.
+/// \param hz edges per second, clamped to QUAD_EDGE_HZ_MAX
+void potmouse_edgerate(uint16_t hz);
+
+/// \brief SID measurement cycles answered so far, wrapping.
+/// Counts in C1351, paddle and KoalaPad modes.
+uint8_t potmouse_cycles();
+
 #endif
 
 //$Id$
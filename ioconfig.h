@@ -5,6 +5,7 @@
 #define _IOCONFIG_H
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #define PS2PORT PORTD           ///< PS2 port
 #define PS2PIN  PIND            ///< PS2 input
@@ -12,7 +13,7 @@
 #define PS2CLK  2               ///< PS2CLK is pin 2
 #define PS2DAT  4               ///< PS2DAT is pin 4
 
-#define PS2_RXBUF_LEN  16       ///< PS2 receive buffer size
+#define PS2_RXBUF_LEN  16       ///< PS2 receive buffer size, power of 2
 
 
 #define SENSEPORT   PORTD       ///< SID sense port
@@ -34,6 +35,16 @@
 #define JOYLEFT     3           ///< Joystick LEFT switch
 #define JOYRIGHT    4           ///< Joystick RIGHT switch
 #define JOYFIRE     1           ///< Joystick FIRE switch
+#define JOYFIRE_MUX 1           ///< ADC channel of FIRE, comparator input for the NEOS strobe
+
+/// \brief Set bits in a register that interrupt handlers change too, such as TIMSK or GICR.
+/// Above the bit-addressable range &= and |= are read-modify-write: a handler running
+/// between read and write would have its change undone. Interrupts are off for the
+/// three cycles of it. Not needed in handlers that run with interrupts disabled.
+#define IO_SET(reg, bits)   do { uint8_t sreg_ = SREG; cli(); (reg) |= (bits); SREG = sreg_; } while (0)
+
+/// \brief Clear bits in a register that interrupt handlers change too, see IO_SET().
+#define IO_CLR(reg, bits)   do { uint8_t sreg_ = SREG; cli(); (reg) &= (uint8_t)~(bits); SREG = sreg_; } while (0)
 
 void io_init();
 
@@ -4,10 +4,16 @@
 ///\brief [M]ouse main file.
 ///
 /// This is the main source file. The main loop inits usart, then ps2 functions, then c1351.
-/// It then calls mouse_boot() which never exits until mouse is succesfully reset and 
-/// initialized in streaming mode. Initial button status is reported and according to buttons
-/// pressed at start, options are set. The default is to boot into C1351 proportional mode,
-/// normal speed (2 counts per mm).
+/// C1351 output starts right away, holding still, so the C64 sees a valid mouse from
+/// power-on. mouse_init() starts the reset and configuration of the PS/2 mouse, which
+/// mouse_poll() carries on in the background, and which later brings the mouse back
+/// if it is unplugged and plugged again. Once the mouse is up, initial button status is
+/// reported and according to buttons pressed at start, options are set. The default is
+/// to stay in C1351 proportional mode, normal speed (2 counts per mm).
+///
+/// Boot times are printed with the first real motion: first pot measurement the SID got
+/// an answer to, mouse up and streaming, first packet with movement or buttons, all in
+/// milliseconds since reset.
 /// 
 /// Right mouse button boots mouse in C1350 (Joystick) mode.
 ///
@@ -15,22 +21,50 @@
 ///
 /// Middle mouse button boots mouse in slow mode.
 ///
+/// Left and right buttons together boot into Amiga quadrature mouse mode.
+///
+/// Middle and right buttons together boot into Atari ST quadrature mouse mode.
+///
+/// Left and middle buttons together boot into paddle mode. KoalaPad mode is
+/// selected with 'K' key in attached terminal, 'P' selects paddles, 'N' selects
+/// NEOS mouse mode.
+///
 /// A triple button chord at start enables VT-Paint doodle app that works in a VT220 terminal
-/// attached to USART, if any, but probably affects performance of the C1351 mouse. This
+/// attached to USART, if any. Screen updates are incremental and go through the USART
+/// transmit buffer, so PS/2 reception and the C1351 output are not held up. This
 /// is kept in for debugging and fun.
 ///
 /// h/j/k/l/space keys in attached terminal can be used to simulate mouse movement.
 ///
+/// 'p' key toggles motion prediction between PS/2 reports in C1351 mode.
+///
+/// 'r' key toggles high-resolution pot timing (Timer1 at clk/1).
+///
+/// 'a' key toggles adaptive PS/2 sample rate, which is on by default.
+///
+/// 'L' key runs a PS/2 link test with the mouse in wrap mode: 256 bytes of each
+/// test pattern, round-trip time, mouse clock rate and error counts are printed.
+///
+/// 'S' key prints static RAM, deepest stack and free RAM since reset, if built with
+/// 'make STACK_CHECK=1'.
+///
 /// \mainpage [M]ouse: PS/2 to Commodore C1351 Mouse Adapter
 /// \section Description
 /// [M]ouse lets you use a regular PS/2 mouse with a Commodore 64 computer. It supports
-/// both proportional (analog, C1351) and joystick (C1350) modes. This is the source code
+/// both proportional (analog, C1351) and joystick (C1350) modes, and can pose as an
+/// Amiga or Atari ST quadrature mouse, a pair of paddles, a KoalaPad or a NEOS mouse. This is the source code
 /// of [M]ouse firmware for ATmega8 microcontroller. It must be compiled with avr-gcc.
 /// \section Files
 /// - main.c    main file
 /// - ps2.c     Interrupt-driven PS/2 protocol implementation
 /// - mouse.c   Mouse protocol implementation: boot and configuration
 /// - c1351.c   Timer-based Commodore mouse emulation
+/// - vtpaint.c VT-Paint doodle app
+/// - timebase.c Millisecond/microsecond clock and software timers
+/// - out.c     Typed diagnostic output, replaces printf_P
+/// - ring.h    Lock-free ring buffer shared by interrupt handlers and main loop
+/// - stack.c   Stack high water mark, with STACK_CHECK=1
+/// - bench.c   Microbenchmark firmware, built with 'make bench'
 ///
 /// \section a How it works
 /// It boots the PS/2 mouse into streaming mode. Mouse sends updated position with every
@@ -47,117 +81,170 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/pgmspace.h>
-#include <stdio.h>
 #include <stdlib.h>
 
 #include "usrat.h"
+#include "out.h"
 #include "ioconfig.h"
 #include "ps2.h"
 #include "mouse.h"
 #include "c1351.h"
-#include "tdelay.h"
+#include "timebase.h"
+#include "timing.h"
+#include "vtpaint.h"
+#include "stack.h"
+
+#define BAUDRATE    19200   ///< USART baudrate
 
-/// Fresh movement packet, raw
-MouseMovt   movt_packet;
+#define BOOT_NOTYET 0xffff  ///< Boot time not reached yet
+
+STATIC_ASSERT(USART_ERROR_PERMILLE(BAUDRATE) <= 20, baudrate_error_exceeds_2_percent);
 
 /// Decoded movement packet
 DecodedMovt movt;
 
-/// VT-Paint test app for VT220 doodling
-void vtpaint();
-
 /// Program main
 int main() {
-    uint8_t i;
     uint8_t byte;
     uint8_t vtpaint_on = 0;
     uint8_t joymode = 0;
+    uint8_t predict = 0;
+    uint8_t hires = 0;
+    uint8_t autorate = 1;
+    uint8_t booted = 0;
+    uint8_t cycles;
     
     uint16_t zero = 320;
+    uint16_t pot_ms = BOOT_NOTYET;
+    uint16_t mouse_ms = BOOT_NOTYET;
+    uint16_t motion_ms = BOOT_NOTYET;
     
-    usart_init(F_CPU/16/19200-1);
+    usart_init(USART_UBRR(BAUDRATE));
 	
-    printf_P(PSTR("\033[2J\033[H[M]AUS B%s (C)SVO 2009 PRESS @\n"), BUILDNUM);
+    out_cls();
+    OUT_P("[M]AUS B" BUILDNUM " (C)SVO 2009 PRESS @\n");
 
     io_init();
+    
+    timebase_init();
 
     ps2_init();
 
     potmouse_init();
     potmouse_zero(zero);
 
-    // enable interruptski
-    sei();
-
-    byte = mouse_boot();
-    
+    // C1351 centred and holding still until the mouse is up
     joymode = POTMOUSE_C1351;
-    
-    switch (byte & 7) {
-        case 001: // [__@]
-            // right mouse button pressed, joystick mode
-            printf_P(PSTR("Joystick mode\n"));
-            joymode = POTMOUSE_JOYSTICK;
-            break;
-        case 007: // [@@@]
-            printf_P(PSTR("VT-Paint enabled\n"));
-            vtpaint_on = 1;
-            break;
-        case 004: // [@__]
-            printf_P(PSTR("1351 Fast\n"));
-            mouse_setres(2);
-            break;
-        case 002: // [_@_]
-            printf_P(PSTR("1351 Slow\n"));
-            mouse_setres(0);
-            break;
-        case 000: // [___]
-        default:
-            printf_P(PSTR("1351 Normal\n"));
-            // normal boot
-            break;
-    }
-    
     potmouse_start(joymode);    
     potmouse_movt(0,0,0); 
-    
-    // usart seems to be capable of giving trouble when left disconnected
-    // if no characters appear in buffer by this moment, disable it 
-    // completely just in case
-    
-    if (!uart_available()) {
-        usart_stop();
-    } else if (uart_getchar() != '@') {
-        usart_stop();
-    }
+    cycles = potmouse_cycles();
 
-    printf_P(PSTR("hjkl to move, space = leftclick\n"));
+    // enable interruptski
+    sei();
+
+    mouse_init();
     
-    for(i = 0;;) {
-        if (ps2_avail()) {
-            byte = ps2_getbyte();
-            movt_packet.byte[i] = byte;
-            
-            i = (i + 1) % 3;
+    for(;;) {
+        potmouse_poll();
+        timer_poll();
+        
+        // first SID cycle answered, back-dated by those answered since
+        if (pot_ms == BOOT_NOTYET && (byte = potmouse_cycles() - cycles) != 0) {
+            pot_ms = timebase_ms() - (uint32_t)(byte - 1) * 512 / 1000;
+        }
         
-            // parse full packet
-            if (i == 0) {
-                movt.dx = ((movt_packet.fields.bits & _BV(XSIGN)) ? 0xff00 : 0) | movt_packet.fields.dx;
-                movt.dy = ((movt_packet.fields.bits & _BV(YSIGN)) ? 0xff00 : 0) | movt_packet.fields.dy;
-                                
-                movt.buttons = movt_packet.fields.bits & 7;
-                
-                // tell c1351 emulator that movement happened
-                potmouse_movt(movt.dx, movt.dy, movt.buttons);
+        // receive packets, reconfigure mouse if it's been replugged
+        byte = mouse_poll(&movt);
+        if (byte == MOUSE_POLL_BUTTONS) {
+            // click ahead of the rest of its packet
+            potmouse_buttons(movt.buttons);
+        } else if (byte == MOUSE_POLL_PACKET) {
+            // tell c1351 emulator that movement happened
+            potmouse_movt(movt.dx, movt.dy, movt.buttons);
 
-                // doodle on vt terminal
-                if (vtpaint_on) vtpaint();                
+            // doodle on vt terminal
+            if (vtpaint_on) vtpaint_movt(movt.dx, movt.dy, movt.buttons);
+            
+            if (motion_ms == BOOT_NOTYET && (movt.dx || movt.dy || movt.buttons)) {
+                motion_ms = timebase_ms();
+                OUT_P("BOOT: pot ");
+                out_udec(pot_ms, 0);
+                OUT_P(" ms, mouse ");
+                out_udec(mouse_ms, 0);
+                OUT_P(" ms, motion ");
+                out_udec(motion_ms, 0);
+                OUT_P(" ms\n");
             }
         } 
         
-        // handle keyboard commands
-        if (uart_available()) {
-            putchar(byte = uart_getchar());
+        // mouse is up for the first time: buttons held select options
+        if (mouse_booted(&byte)) {
+            mouse_ms = timebase_ms();
+            
+            switch (byte & 7) {
+                case 001: // [__@]
+                    // right mouse button pressed, joystick mode
+                    OUT_P("Joystick mode\n");
+                    joymode = POTMOUSE_JOYSTICK;
+                    break;
+                case 007: // [@@@]
+                    OUT_P("VT-Paint enabled\n");
+#ifdef VTPAINT
+                    vtpaint_init();
+                    vtpaint_on = 1;
+#endif
+                    break;
+                case 004: // [@__]
+                    OUT_P("1351 Fast\n");
+                    mouse_setres(2);
+                    break;
+                case 002: // [_@_]
+                    OUT_P("1351 Slow\n");
+                    mouse_setres(0);
+                    break;
+                case 005: // [@_@]
+                    OUT_P("Amiga mode\n");
+                    joymode = POTMOUSE_AMIGA;
+                    break;
+                case 003: // [_@@]
+                    OUT_P("Atari ST mode\n");
+                    joymode = POTMOUSE_ATARIST;
+                    break;
+                case 006: // [@@_]
+                    OUT_P("Paddle mode\n");
+                    joymode = POTMOUSE_PADDLE;
+                    break;
+                case 000: // [___]
+                default:
+                    OUT_P("1351 Normal\n");
+                    // normal boot
+                    break;
+            }
+            
+            if (joymode != POTMOUSE_C1351) {
+                potmouse_start(joymode);
+                potmouse_movt(0,0,0);
+            }
+            
+            // usart seems to be capable of giving trouble when left disconnected
+            // if no characters appear in buffer by this moment, disable it 
+            // completely just in case
+            
+            if (!uart_available()) {
+                usart_stop();
+            } else if (uart_getchar() != '@') {
+                usart_stop();
+            }
+
+            OUT_P("hjkl to move, space = leftclick, P/K/N = paddle/KoalaPad/NEOS\n");
+            booted = 1;
+        }
+        
+        if (vtpaint_on) vtpaint_update();
+        
+        // handle keyboard commands, once '@' has been looked for
+        if (booted && uart_available()) {
+            out_char(byte = uart_getchar());
             switch (byte) {             
                 case 'q':   potmouse_zero(--zero);
                             break;       
@@ -173,44 +260,27 @@ int main() {
                             break;
                 case ' ':   potmouse_movt(0, 0, 1);
                             break;
+                case 'P':   potmouse_start(POTMOUSE_PADDLE);
+                            break;
+                case 'K':   potmouse_start(POTMOUSE_KOALA);
+                            break;
+                case 'N':   potmouse_start(POTMOUSE_NEOS);
+                            break;
+                case 'p':   potmouse_predict(predict ^= 1);
+                            break;
+                case 'r':   potmouse_hires(hires ^= 1);
+                            break;
+                case 'a':   mouse_autorate(autorate ^= 1);
+                            break;
+                case 'L':   mouse_linktest(256, LINKTEST_ALL);
+                            break;
+#if STACK_CHECK
+                case 'S':   stack_report();
+                            break;
+#endif
             }
         }
     }
 }
 
-void vtpaint() {                    
-#ifdef VTPAINT
-    static int16_t absoluteX = 0, absoluteY = 0;
-    static int16_t termX, termY;
-    static uint8_t last_buttons = 0;
-
-    uint8_t moved = 0;
-
-    ps2_enable_recv(0);
-    absoluteX += movt.dx;
-    absoluteY += movt.dy;
-
-    moved = termX != absoluteX/33 || termY != absoluteY/66 || last_buttons != movt.buttons;
-
-    if (moved) {
-        printf_P(PSTR("\033[%d;%dH%c"), 12-termY, 40+termX, movt.buttons ? '#':' ');
-
-        last_buttons = movt.buttons;
-        termX = absoluteX/33;
-        termY = absoluteY/66;
-
-        printf_P(PSTR("\033[%d;%dH%c"), 12-termY, 40+termX, movt.buttons + '0');
-    }
-
-    printf_P(PSTR("\033[HX=%+6d Y=%+6d [%c %c %c]\r"), 
-                absoluteX, absoluteY,
-                (movt.buttons & _BV(BUTTON1)) ? '@':' ',
-                (movt.buttons & _BV(BUTTON3)) ? '@':' ',
-                (movt.buttons & _BV(BUTTON2)) ? '@':' ');
-    
-    ps2_enable_recv(1);
-#endif
-}
-
-
 //$Id$
@@ -1,5 +1,45 @@
 //!\file 
 //!\brief Mouse protocol implementation.
+//!
+//! mouse_init() starts bringing the mouse up at power-on, in the background: reset,
+//! self-test and configuration are steps of a state machine that mouse_poll() advances,
+//! the waits in between are deadlines, so the main loop and the C64 side keep running.
+//! After that mouse_poll() assembles stream packets and supervises the link. A
+//! replugged or browned-out mouse announces itself with self-test result 0xAA
+//! followed by id 0x00 and then keeps silent, because after reset data reporting is
+//! disabled. A mouse that is just not moved is silent too, so after a long silence it
+//! is asked for its status: no answer or reporting disabled means it needs to be
+//! configured again. Silence is timed with a software timer that every received byte
+//! rearms. Reconfiguration goes through the same state machine, C1351 outputs are
+//! interrupt-driven and hold their last position meanwhile.
+//!
+//! Commands to a streaming mouse don't wait for the answer either: mouse_poll() takes
+//! it as it comes in, with the link timer as deadline. Stream packets that were on
+//! the way when the command went out arrive first and still go to the packet parser.
+//! While an ACK is outstanding, 0xfa is taken as the ACK even in the middle of a
+//! packet: the mouse cuts a report short for a command, so the partial packet is
+//! dropped instead of being completed with the ACK.
+//!
+//! Buttons are in the first byte of a packet, so a button change is handed out as soon
+//! as that byte is in, about two byte times before the packet is complete. Only if the
+//! stream was in sync for the whole packet before it: no command exchange, receive
+//! error or dropped byte since, which could shift a movement byte into first place.
+//! And the byte must have no overflow bits, which ACK and self-test codes have.
+//!
+//! Sample rate follows motion speed. Movement is summed over RATE_WINDOW_MS windows
+//! and the rate goes up one or more steps as soon as a window is fast enough, and down
+//! a step only after RATE_HOLD_WINDOWS slow windows in a row. The change is applied
+//! between packets with MOUSE_SSR and its argument, as a command exchange (see above):
+//! the mouse answers every byte within a millisecond or so and then goes on streaming.
+//! Movement is only lost if the mouse cuts a report short for the command, and then
+//! only that report. An exchange that times out is started over from MOUSE_SSR,
+//! RATE_TRIES times, so the mouse is not left waiting for the argument.
+//!
+//! mouse_linktest() qualifies mouse and cable. In wrap mode the mouse echoes every
+//! byte it receives, except the reset and reset-wrap commands, so each test byte
+//! makes a full round through ps2_sendbyte() and the receive path. The receiver is
+//! busy from the echo's start bit until its stop bit, 10 clock periods, which gives
+//! the clock rate of the mouse. A byte that doesn't come back intact is sent again.
 
 
 #include <inttypes.h>
@@ -7,74 +47,479 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/pgmspace.h>
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "usrat.h"
+#include "out.h"
 #include "ioconfig.h"
 #include "ps2.h"
 #include "mouse.h"
-#include "tdelay.h"
+#include "timebase.h"
 
 const char PSTR_OK[]    PROGMEM      = "OK";
 const char PSTR_ERROR[] PROGMEM      = "ERROR";
 
+#define LINK_QUIET_MS       2000    ///< Silence before the mouse is probed
+#define LINK_PARTIAL_MS     30      ///< Incomplete packet is dropped after this long
+#define LINK_RETRY_MS       1000    ///< Pause between attempts to bring a missing mouse back
+
+#define MOUSE_ACK_MS        25      ///< Mouse must answer a command within this time
+
+#define BOOT_RESETS         3       ///< Reset commands per attempt, the last must be acknowledged
+#define BOOT_SELFTEST_MS    250     ///< Self-test result poll interval
+#define BOOT_SELFTEST_POLLS 11      ///< Polls before self-test is given up
+#define BOOT_SETTLE_MS      100     ///< Self-test passed, let device id arrive
+#define BOOT_REPLY_MS       22      ///< Configuration command to reply
+#define BOOT_FLUSH_MS       100     ///< Reporting enabled, let leftovers pass
+
+#define LINKTEST_TRIES      3       ///< Attempts per link test byte
+
+/// Link test pattern names, 4 bytes apart
+static const char linktest_names[] PROGMEM = "ALT\0WLK\0CNT\0RND";
+
+#define RATE_WINDOW_MS      250     ///< Motion speed is measured over this long
+#define RATE_HOLD_WINDOWS   4       ///< Slow windows in a row before the rate goes down
+#define RATE_STEPS          3       ///< Number of sample rate steps
+#define RATE_DEFAULT        1       ///< Rate step of a freshly reset mouse
+#define RATE_TRIES          3       ///< Sample rate exchanges before the change waits for the next window
+
+/// Motion speed threshold, counts/s, in counts per window
+#define RATE_CPS(cps)       ((uint16_t)((cps) * (uint32_t)RATE_WINDOW_MS / 1000))
+
+/// Sample rates, reports/s
+static const uint8_t rate_hz[RATE_STEPS] = {40, 100, 200};
+
+/// Window counts above which rate goes up from step i
+static const uint16_t rate_up[RATE_STEPS - 1] = {RATE_CPS(60), RATE_CPS(400)};
+
+/// Window counts below which rate goes down to step i
+static const uint16_t rate_down[RATE_STEPS - 1] = {RATE_CPS(20), RATE_CPS(250)};
+
+static MouseMovt packet;            ///< Packet being assembled
+static uint8_t packet_len;          ///< Bytes in packet
+static uint8_t mouse_res = 1;       ///< Resolution code, restored on relink
+static uint8_t link_up;             ///< Mouse configured and streaming
+static uint8_t link_timer = TIMER_NONE; ///< Silence timer
+static volatile uint8_t link_due;   ///< Silence timer expired
+
+/// Command exchange with a streaming mouse, see cmd_take()
+enum _cmdstate {
+    CMD_OFF = 0,                    ///< nothing outstanding
+    CMD_ACK,                        ///< byte cmd_pos sent, waiting for its ACK
+    CMD_REPLY,                      ///< all acknowledged, taking reply bytes
+};
+
+static uint8_t cmd_state;           ///< See _cmdstate
+static uint8_t cmd_bytes[2];        ///< Command and argument, each is acknowledged
+static uint8_t cmd_len;             ///< Bytes in cmd_bytes
+static uint8_t cmd_pos;             ///< Byte waiting for its ACK
+static uint8_t cmd_reply[3];        ///< Reply after the last ACK
+static uint8_t cmd_want;            ///< Reply bytes expected
+static uint8_t cmd_got;             ///< Reply bytes taken
+static uint8_t cmd_heard;           ///< Stream bytes came in meanwhile
+static void (*cmd_done)(uint8_t);   ///< Called at the end, 1 = no answer in time
+static uint8_t cmd_rate;            ///< Sample rate step being switched to
+
+/// Background boot states
+enum _bootstate {
+    BOOT_OFF = 0,                   ///< not booting: link is up or waits for a retry
+    BOOT_RESET,                     ///< sending reset commands
+    BOOT_SELFTEST,                  ///< waiting for self-test result
+    BOOT_SETTLE,                    ///< self-test passed, waiting for the device id
+    BOOT_COMMAND,                   ///< configuration command sent, waiting for reply
+    BOOT_FLUSH,                     ///< reporting enabled, skipping leftovers
+};
+
+/// Configuration after reset, 0 stands for the resolution code
+static const uint8_t boot_commands[] PROGMEM = {
+    MOUSE_DDR, MOUSE_SETSCALE21, MOUSE_SETRES, 0, MOUSE_STATUSRQ, MOUSE_EDR,
+};
+
+static uint8_t boot_state;          ///< See _bootstate
+static uint8_t boot_step;           ///< Reset, poll or command number
+static uint32_t boot_due;           ///< timebase_ms() of the next step
+static uint32_t boot_start;         ///< Attempt started
+static uint8_t boot_first = 1;      ///< Power-on boot, not a relink
+static uint8_t boot_buttons;        ///< Buttons read during configuration
+static uint8_t boot_report;         ///< Power-on boot done, not told yet
+
+static uint8_t buttons_last;        ///< Buttons last handed out by mouse_poll()
+static uint8_t synced;              ///< Last packet complete, nothing since that breaks alignment
+static uint8_t rx_errors;           ///< ps2_rxerrors() when last looked at
+
+static uint8_t rate_on = 1;         ///< Adaptive sample rate enabled
+static uint8_t rate_step = RATE_DEFAULT; ///< Sample rate step the mouse is set to
+static uint8_t rate_want = RATE_DEFAULT; ///< Sample rate step to switch to
+static uint8_t rate_slow;           ///< Slow windows in a row
+static uint16_t rate_counts;        ///< Movement in current window, |dx|+|dy|
+static uint8_t rate_timer = TIMER_NONE; ///< Measurement window timer
+static uint8_t rate_tries;          ///< Sample rate exchanges started for this change
+
+/// Link test results of one pattern
+typedef struct _linkstat {
+    uint16_t bytes;                 ///< bytes echoed intact
+    uint16_t failed;                ///< bytes given up after LINKTEST_TRIES attempts
+    uint16_t retransmits;           ///< bytes sent again
+    uint16_t lost;                  ///< no echo
+    uint16_t mismatch;              ///< wrong echo
+    uint16_t rtt_min;               ///< round trip, us
+    uint16_t rtt_max;
+    uint32_t rtt_sum;
+    uint32_t frame_sum;             ///< echo start bit to stop bit, us
+    uint16_t frames;                ///< echo frames timed
+} LinkStat;
+
 static void mouse_flush(uint8_t pace) {
-    tdelay(pace); 
+    timebase_delay(pace); 
     do {
-        if (ps2_avail()) printf_P(PSTR("%02x "), ps2_getbyte());
-        tdelay(pace); 
+        if (ps2_avail()) {
+            out_hex8(ps2_getbyte());
+            out_char(' ');
+        }
+        timebase_delay(pace); 
     } while (ps2_avail());
 }
 
-uint8_t mouse_reset() {
-    uint8_t i, b = 33;
-    const int ntries = 11;
+static void link_timeout() {
+    link_due = 1;
+}
+
+/// \brief Expect mouse to say something within ms milliseconds.
+static void link_watch(uint16_t ms) {
+    link_due = 0;
+    timer_restart(link_timer, ms);
+}
+
+/// \brief A stream byte came in: rearm the silence timer, unless it times a command.
+static void link_heard(uint16_t ms) {
+    if (cmd_state == CMD_OFF) link_watch(ms);
+}
 
-    // send reset command    
-    ps2_sendbyte(MOUSE_RESET);
-    ps2_sendbyte(MOUSE_RESET);
-    ps2_sendbyte(MOUSE_RESET);
+/// \brief Command exchange is over, tell whoever started it.
+static void cmd_end(uint8_t fail) {
+    cmd_state = CMD_OFF;
+    link_watch(packet_len ? LINK_PARTIAL_MS : LINK_QUIET_MS);
+    cmd_done(fail);
+}
+
+/// \brief Send byte cmd_pos, its ACK is due within MOUSE_ACK_MS.
+static void cmd_send() {
+    cmd_state = CMD_ACK;
+    if (ps2_sendbyte(cmd_bytes[cmd_pos])) {
+        cmd_end(1);
+    } else {
+        link_watch(MOUSE_ACK_MS);
+    }
+}
+
+/// \brief Start a command exchange between packets, mouse_poll() carries it on.
+/// \param len command bytes in cmd_bytes
+/// \param reply bytes that follow the last ACK
+/// \param done called with 0 when answered, 1 when not
+static void cmd_start(uint8_t len, uint8_t reply, void (*done)(uint8_t)) {
+    // the mouse may cut a report short for it
+    synced = 0;
+    cmd_len = len;
+    cmd_pos = 0;
+    cmd_want = reply;
+    cmd_got = 0;
+    cmd_heard = 0;
+    cmd_done = done;
+    cmd_send();
+}
+
+/// \brief Offer a received byte to the command exchange.
+/// \return 1 if taken, 0 if it's a stream byte for the packet parser
+static uint8_t cmd_take(uint8_t byte) {
+    if (cmd_state == CMD_REPLY) {
+        // the reply comes in one piece right after the ACK
+        cmd_reply[cmd_got] = byte;
+        if (++cmd_got == cmd_want) cmd_end(0);
+        return 1;
+    }
     
-    // wait for some time for mouse self-test to complete
-    for (i = 0; i < ntries; i++) {
-        tdelay(250);
-        if (ps2_avail()) {
-            b = ps2_getbyte(); printf_P(PSTR("%02x "));
-            if (b == MOUSE_RESETOK) {
-                break;
-            } else {
-                i = ntries;
-                break;
-            }
-        }
+    // stream packets on the way come first
+    if (byte != MOUSE_ACK) {
+        cmd_heard = 1;
+        return 0;
     }
+    
+    // the mouse cut a report short for the command, the rest won't come
+    packet_len = 0;
+    
+    if (++cmd_pos < cmd_len) {
+        cmd_send();
+    } else if (cmd_want) {
+        cmd_state = CMD_REPLY;
+        link_watch(MOUSE_ACK_MS);
+    } else {
+        cmd_end(0);
+    }
+    return 1;
+}
 
-    if (i == ntries) return -1;
+/// \brief Close a measurement window and decide on the sample rate.
+static void rate_window() {
+    uint16_t c = rate_counts;
+    uint8_t s = rate_step;
+    
+    rate_counts = 0;
     
-    // flush the rest of reponse, most likely mouse id == 0
-    tdelay(100);
-    mouse_flush(0);
+    if (!rate_on) return;
     
-    return 0;
+    if (s < RATE_STEPS - 1 && c > rate_up[s]) {
+        while (s < RATE_STEPS - 1 && c > rate_up[s]) s++;
+        rate_slow = 0;
+    } else if (s > 0 && c < rate_down[s - 1]) {
+        if (++rate_slow >= RATE_HOLD_WINDOWS) {
+            s--;
+            rate_slow = 0;
+        }
+    } else {
+        rate_slow = 0;
+    }
+    
+    rate_want = s;
+}
+
+/// \brief Wait for the mouse to acknowledge a command.
+/// Stream packets that were already on the way are skipped whole: 0xfa is a valid
+/// movement byte, so the ACK is only taken between packets. Unlike cmd_take() this
+/// hands no movement on, so a packet cut short only makes it time out.
+/// \return 0 if acknowledged
+static uint8_t mouse_ack() {
+    uint32_t start = timebase_ms();
+    uint8_t n = packet_len;
+    uint8_t byte;
+    
+    while (timebase_ms() - start < MOUSE_ACK_MS) {
+        if (!ps2_avail()) continue;
+        
+        byte = ps2_getbyte();
+        if (n == 0 && byte == MOUSE_ACK) return 0;
+        
+        // bytes of a packet; out of sync until a first byte with bit 3 set
+        if (n != 0 || (byte & _BV(3))) n = (n + 1) % 3;
+    }
+    return 1;
+}
+
+/// \brief Sample rate exchange ended.
+static void rate_done(uint8_t fail) {
+    if (!fail) {
+        rate_step = cmd_rate;
+    } else if (++rate_tries < RATE_TRIES) {
+        // the mouse may still wait for the argument: start over with the command
+        cmd_start(2, 0, rate_done);
+    } else {
+        // try again when the next window asks for it
+        rate_want = rate_step;
+    }
+}
+
+void mouse_autorate(uint8_t on) {
+    rate_on = on;
+    rate_slow = 0;
+    if (!on) rate_want = RATE_DEFAULT;
 }
 
 int16_t mouse_command(uint8_t cmd, uint8_t wait) {
     int16_t response = -1;
     
-    ps2_sendbyte(cmd);
+    if (ps2_sendbyte(cmd)) {
+        wait = 0;
+    }
     if (wait) {
-        tdelay(22);
+        timebase_delay(22);
         if (ps2_avail()) response = ps2_getbyte();
     }
     
-    printf_P(PSTR("%02x>%02x "), cmd, response); 
+    out_hex8(cmd);
+    out_char('>');
+    if (response < 0) {
+        OUT_P("ffff");
+    } else {
+        out_hex8(response);
+    }
+    out_char(' ');
     
     return response;
 }
 
 
+/// \brief Next byte of a link test pattern.
+/// \param pattern one of LINKTEST_ pattern bits
+/// \param i byte number
+/// \param lfsr pseudo-random generator state
+static uint8_t linktest_pattern(uint8_t pattern, uint16_t i, uint8_t *lfsr) {
+    uint8_t b;
+    
+    switch (pattern) {
+        case LINKTEST_ALTERNATE:
+            b = (i & 1) ? 0xaa : 0x55;
+            break;
+        case LINKTEST_WALKING:
+            b = _BV(i & 7);
+            if (i & 8) b = ~b;
+            break;
+        case LINKTEST_COUNT:
+            b = i;
+            break;
+        default:
+            // Galois LFSR, x^8 + x^6 + x^5 + x^4 + 1
+            *lfsr = (*lfsr >> 1) ^ ((*lfsr & 1) ? 0xb8 : 0);
+            b = *lfsr;
+            break;
+    }
+    
+    // these are commands even in wrap mode
+    if (b == MOUSE_RESET || b == MOUSE_RESETWRAP) b ^= 0x10;
+    
+    return b;
+}
+
+/// \brief Skip whatever else the mouse has to say.
+static void linktest_drain() {
+    timebase_delay(5);
+    while (ps2_avail()) ps2_getbyte();
+}
+
+/// \brief Send one byte in wrap mode and wait for the echo.
+/// \return 0 if echoed intact
+static uint8_t linktest_byte(uint8_t b, LinkStat *ls) {
+    uint32_t t0, t1, t2;
+    uint16_t rtt;
+    uint8_t tries, framed;
+    
+    for (tries = 0; tries < LINKTEST_TRIES; tries++) {
+        if (tries) ls->retransmits++;
+        
+        t0 = timebase_us();
+        if (ps2_sendbyte(b)) {
+            // counted by ps2.c
+            linktest_drain();
+            continue;
+        }
+        
+        // start bit of the echo makes the receiver busy, the stop bit completes it
+        do {
+            t1 = timebase_us();
+        } while (!ps2_busy() && !ps2_avail() && t1 - t0 < MOUSE_ACK_MS * 1000UL);
+        framed = !ps2_avail();
+        do {
+            t2 = timebase_us();
+        } while (!ps2_avail() && t2 - t0 < MOUSE_ACK_MS * 1000UL);
+        
+        if (!ps2_avail()) {
+            ls->lost++;
+            linktest_drain();
+            continue;
+        }
+        if (ps2_getbyte() != b) {
+            ls->mismatch++;
+            linktest_drain();
+            continue;
+        }
+        
+        rtt = t2 - t0;
+        if (rtt < ls->rtt_min) ls->rtt_min = rtt;
+        if (rtt > ls->rtt_max) ls->rtt_max = rtt;
+        ls->rtt_sum += rtt;
+        ls->bytes++;
+        if (framed) {
+            ls->frame_sum += t2 - t1;
+            ls->frames++;
+        }
+        return 0;
+    }
+    
+    ls->failed++;
+    return 1;
+}
+
+void mouse_linktest(uint16_t count, uint8_t patterns) {
+    LinkStat ls;
+    PS2Stats st;
+    uint8_t lfsr = 1;
+    uint8_t p;
+    uint16_t i;
+    
+    // a late answer to a pending exchange is skipped like stream bytes
+    cmd_state = CMD_OFF;
+    
+    OUT_P("\nLINK TEST: ");
+    
+    // stream bytes that are on the way are skipped by mouse_ack()
+    if (!link_up || ps2_sendbyte(MOUSE_DDR) || mouse_ack() || ps2_sendbyte(MOUSE_SETWRAP) || mouse_ack()) {
+        out_line_P(PSTR_ERROR);
+    } else {
+        out_line_P(PSTR_OK);
+        linktest_drain();
+        ps2_stats(&st, 1);
+        
+        // round trip in us, clock in Hz
+        OUT_P("PAT BYTES   MIN   AVG   MAX  CLOCK LOST  BAD RETX FAIL\n");
+        for (p = 0; p < 4; p++) {
+            if (!(patterns & _BV(p))) continue;
+            
+            memset(&ls, 0, sizeof(ls));
+            ls.rtt_min = 0xffff;
+            for (i = 0; i < count; i++) {
+                linktest_byte(linktest_pattern(_BV(p), i, &lfsr), &ls);
+            }
+            
+            out_str_P(linktest_names + 4 * p);
+            out_udec(ls.bytes, 6);
+            out_udec(ls.bytes ? ls.rtt_min : 0, 6);
+            out_udec(ls.bytes ? (uint16_t)(ls.rtt_sum / ls.bytes) : 0, 6);
+            out_udec(ls.rtt_max, 6);
+            out_udec(ls.frames ? (uint16_t)(10000000UL / (ls.frame_sum / ls.frames)) : 0, 7);
+            out_udec(ls.lost, 5);
+            out_udec(ls.mismatch, 5);
+            out_udec(ls.retransmits, 5);
+            out_udec(ls.failed, 5);
+            out_char('\n');
+        }
+        
+        ps2_stats(&st, 0);
+        OUT_P("RX FRAMING ");
+        out_udec(st.rx_framing, 0);
+        OUT_P(" PARITY ");
+        out_udec(st.rx_parity, 0);
+        OUT_P(" TIMEOUT ");
+        out_udec(st.rx_timeout, 0);
+        OUT_P(", TX NOACK ");
+        out_udec(st.tx_noack, 0);
+        OUT_P(" TIMEOUT ");
+        out_udec(st.tx_timeout, 0);
+        OUT_P(", BUF OVERFLOW ");
+        out_udec(st.rx_buf.overflows, 0);
+        OUT_P(" HIGH ");
+        out_udec(st.rx_buf.high, 0);
+        out_char('\n');
+        
+        // not echoed: leaves wrap mode, acknowledged
+        mouse_command(MOUSE_RESETWRAP, 1);
+    }
+    
+    mouse_command(MOUSE_EDR, 1);
+    mouse_flush(5);
+    out_char('\n');
+    
+    packet_len = 0;
+    synced = 0;
+    link_watch(LINK_QUIET_MS);
+}
+
 void mouse_setres(uint8_t res) {
+    mouse_res = res;
+    
+    // a boot in progress picks it up
+    if (boot_state != BOOT_OFF) return;
+    
+    cmd_state = CMD_OFF;
+    
     mouse_command(MOUSE_DDR,1);
     
     mouse_command(MOUSE_SETRES, 1);
@@ -83,42 +528,258 @@ void mouse_setres(uint8_t res) {
     mouse_command(MOUSE_EDR,1);
 }
 
-uint8_t mouse_boot() {
-    uint8_t buttons = 0;
+/// \brief Start resetting and configuring the mouse in the background.
+static void mouse_restart() {
+    if (boot_first) {
+        OUT_P("\nRESET: ");
+    } else {
+        OUT_P("\nRELINK: ");
+    }
     
     ps2_enable_recv(1);
+    link_up = 0;
+    cmd_state = CMD_OFF;
+    boot_state = BOOT_RESET;
+    boot_step = 0;
+    boot_start = timebase_ms();
+}
 
-    for(;;) {
-        printf_P(PSTR("\nRESET: "));
-        if (mouse_reset() == 0) {
-            puts_P(PSTR_OK);
-            break;
-        } else {
-            puts_P(PSTR_ERROR);
-        }
+/// \brief Attempt failed, try again after a pause.
+static void boot_fail() {
+    out_line_P(PSTR_ERROR);
+    boot_state = BOOT_OFF;
+    link_up = 0;
+    link_watch(LINK_RETRY_MS);
+}
+
+/// \brief Send configuration command boot_step, reply is due in BOOT_REPLY_MS.
+static void boot_send() {
+    uint8_t cmd = pgm_read_byte(&boot_commands[boot_step]);
+    
+    if (cmd == 0) cmd = mouse_res;
+    
+    // not sent: no reply to wait for
+    boot_due = timebase_ms() + (ps2_sendbyte(cmd) ? 0 : BOOT_REPLY_MS);
+}
+
+/// \brief Configuration done, mouse is streaming.
+static void boot_done() {
+    if (boot_first) {
+        out_char('\n');
+        boot_first = 0;
+        boot_report = 1;
+    } else {
+        OUT_P("UP ");
+        out_udec((uint16_t)(timebase_ms() - boot_start), 0);
+        OUT_P(" ms\n");
     }
+    
+    // reset brought sample rate back to default
+    rate_step = RATE_DEFAULT;
+    boot_state = BOOT_OFF;
+    packet_len = 0;
+    synced = 0;
+    link_up = 1;
+    link_watch(LINK_QUIET_MS);
+}
 
-    mouse_command(MOUSE_DDR, 1);
-    mouse_command(MOUSE_SETSCALE21, 1);
+/// \brief Take the next boot step if it's due. Never waits, except for ps2_sendbyte().
+static void boot_poll() {
+    uint32_t now = timebase_ms();
+    uint8_t cmd;
+    int16_t response;
     
-    mouse_command(MOUSE_SETRES, 1);
-    mouse_command(1,1);             // 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm
+    if (boot_state != BOOT_RESET && (int32_t)(now - boot_due) < 0) return;
+    
+    switch (boot_state) {
+        case BOOT_RESET:
+            if (ps2_sendbyte(MOUSE_RESET) && boot_step == BOOT_RESETS - 1) {
+                boot_fail();
+            } else if (++boot_step == BOOT_RESETS) {
+                boot_state = BOOT_SELFTEST;
+                boot_step = 0;
+                boot_due = now + BOOT_SELFTEST_MS;
+            }
+            break;
+        case BOOT_SELFTEST:
+            if (ps2_avail()) {
+                cmd = ps2_getbyte();
+                out_hex8(cmd);
+                out_char(' ');
+                if (cmd == MOUSE_RESETOK) {
+                    boot_state = BOOT_SETTLE;
+                    boot_due = now + BOOT_SETTLE_MS;
+                } else {
+                    boot_fail();
+                }
+            } else if (++boot_step == BOOT_SELFTEST_POLLS) {
+                boot_fail();
+            } else {
+                boot_due = now + BOOT_SELFTEST_MS;
+            }
+            break;
+        case BOOT_SETTLE:
+            // most likely device id 0
+            mouse_flush(0);
+            if (boot_first) out_line_P(PSTR_OK);
+            boot_state = BOOT_COMMAND;
+            boot_step = 0;
+            boot_send();
+            break;
+        case BOOT_COMMAND:
+            cmd = pgm_read_byte(&boot_commands[boot_step]);
+            response = ps2_avail() ? ps2_getbyte() : -1;
+            out_hex8(cmd ? cmd : mouse_res);
+            out_char('>');
+            if (response < 0) {
+                OUT_P("ffff");
+            } else {
+                out_hex8(response);
+            }
+            out_char(' ');
+            
+            // status byte 1 follows the ACK: bits 2,1,0 = left, middle, right
+            if (cmd == MOUSE_STATUSRQ) {
+                if (ps2_avail()) boot_buttons = ps2_getbyte() & 7;
+                mouse_flush(0);
+                if (boot_first) {
+                    OUT_P("B:");
+                    out_udec(boot_buttons, 0);
+                    out_char('\n');
+                }
+            }
+            
+            if (++boot_step == sizeof(boot_commands)) {
+                boot_state = BOOT_FLUSH;
+                boot_due = now + BOOT_FLUSH_MS;
+            } else {
+                boot_send();
+            }
+            break;
+        case BOOT_FLUSH:
+            mouse_flush(0);
+            boot_done();
+            break;
+    }
+}
 
-    mouse_command(MOUSE_STATUSRQ, 1);
-    tdelay(22);
-    if (ps2_avail()) buttons = ps2_getbyte() & 7;
+void mouse_init() {
+    if (link_timer == TIMER_NONE) link_timer = timer_start(link_timeout, LINK_QUIET_MS, 0);
+    if (rate_timer == TIMER_NONE) rate_timer = timer_start(rate_window, RATE_WINDOW_MS, RATE_WINDOW_MS);
+    rate_step = rate_want = RATE_DEFAULT;
     
-    mouse_flush(22);
+    mouse_restart();
+}
+
+uint8_t mouse_booted(uint8_t *buttons) {
+    if (!boot_report) return 0;
     
-    printf_P(PSTR("B:%x\n"), buttons);
+    boot_report = 0;
+    *buttons = boot_buttons;
+    return 1;
+}
 
-    mouse_command(MOUSE_EDR, 1);
+/// \brief Status probe answered or not: configure the mouse again if it needs it.
+static void probe_done(uint8_t fail) {
+    // a mouse that streams is there and reports; status bit 5 = data reporting enabled
+    if (fail ? !cmd_heard : (cmd_reply[0] & _BV(5)) == 0) mouse_restart();
+}
 
-    mouse_flush(100);
+void mouse_decode(MouseMovt *p, DecodedMovt *movt) {
+    movt->dx = ((p->fields.bits & _BV(XSIGN)) ? 0xff00 : 0) | p->fields.dx;
+    movt->dy = ((p->fields.bits & _BV(YSIGN)) ? 0xff00 : 0) | p->fields.dy;
+    
+    movt->buttons = p->fields.bits & 7;
+}
 
-    printf_P(PSTR("\n"));
+uint8_t mouse_poll(DecodedMovt *movt) {
+    uint8_t byte;
+    
+    if (boot_state != BOOT_OFF) {
+        boot_poll();
+        return MOUSE_POLL_NONE;
+    }
+    
+    if (link_due) {
+        link_due = 0;
+        if (cmd_state != CMD_OFF) {
+            // no answer in time
+            cmd_end(1);
+        } else if (!link_up) {
+            mouse_restart();
+        } else if (packet_len != 0) {
+            // self-test passed, device id 0 and nothing else: mouse was replugged
+            if (packet_len == 2 && packet.byte[0] == MOUSE_RESETOK && packet.byte[1] == 0) {
+                mouse_restart();
+            } else {
+                link_watch(LINK_QUIET_MS - LINK_PARTIAL_MS);
+            }
+            packet_len = 0;
+            synced = 0;
+        } else if (ps2_avail()) {
+            link_watch(LINK_QUIET_MS);
+        } else {
+            // status byte, resolution and sample rate follow the ACK
+            cmd_bytes[0] = MOUSE_STATUSRQ;
+            cmd_start(1, 3, probe_done);
+        }
+        return MOUSE_POLL_NONE;
+    }
+    
+    if (!ps2_avail()) {
+        // between packets: switch sample rate if the controller wants it
+        if (rate_want != rate_step && link_up && packet_len == 0 && cmd_state == CMD_OFF) {
+            cmd_rate = rate_want;
+            cmd_bytes[0] = MOUSE_SSR;
+            cmd_bytes[1] = rate_hz[cmd_rate];
+            rate_tries = 0;
+            cmd_start(2, 0, rate_done);
+        }
+        return MOUSE_POLL_NONE;
+    }
+    
+    byte = ps2_getbyte();
+    
+    // a frame went missing before this byte
+    if (ps2_rxerrors() != rx_errors) {
+        rx_errors = ps2_rxerrors();
+        synced = 0;
+    }
+    
+    if (cmd_state != CMD_OFF && cmd_take(byte)) return MOUSE_POLL_NONE;
+    
+    // bit 3 of first byte is always 1, wait for it to get in sync
+    if (packet_len == 0 && (byte & _BV(3)) == 0) {
+        synced = 0;
+        link_heard(LINK_QUIET_MS);
+        return MOUSE_POLL_NONE;
+    }
+    
+    packet.byte[packet_len++] = byte;
+    
+    if (packet_len < 3) {
+        link_heard(LINK_PARTIAL_MS);
+        
+        // clicks don't wait for the movement bytes
+        if (packet_len == 1 && synced && (byte & (_BV(XOVERFLOW) | _BV(YOVERFLOW))) == 0 && (byte & 7) != buttons_last) {
+            buttons_last = movt->buttons = byte & 7;
+            movt->dx = movt->dy = 0;
+            return MOUSE_POLL_BUTTONS;
+        }
+        return MOUSE_POLL_NONE;
+    }
+    
+    packet_len = 0;
+    synced = 1;
+    link_heard(LINK_QUIET_MS);
+    mouse_decode(&packet, movt);
+    buttons_last = movt->buttons;
+    
+    // motion speed for sample rate control
+    rate_counts += abs(movt->dx) + abs(movt->dy);
+    if (rate_counts > 0x7fff) rate_counts = 0x7fff;
     
-    return buttons;    
+    return MOUSE_POLL_PACKET;
 }
 
 //$Id$
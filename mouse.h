@@ -60,9 +60,55 @@ typedef struct _decoded_movt {
     uint8_t buttons;                ///< buttons status
 } DecodedMovt;
 
-/// \brief Boot mouse, check and return initial button state.
-/// \return initial button status (bits 2,1,0 == left,middle,right)
-uint8_t mouse_boot();
+/// \brief Start bringing the mouse up. Reset and configuration continue in mouse_poll().
+void mouse_init();
+
+/// \brief Tell when the mouse has come up after power-on, once.
+/// \param buttons initial button status (bits 2,1,0 == left,middle,right), valid if 1 is returned
+/// \return 1 the first time this is called after power-on boot has completed
+uint8_t mouse_booted(uint8_t *buttons);
+
+/// mouse_poll() results
+enum _mouse_poll {
+    MOUSE_POLL_NONE = 0,            ///< nothing to report
+    MOUSE_POLL_PACKET,              ///< complete packet: movement and buttons
+    MOUSE_POLL_BUTTONS,             ///< first byte of a packet with changed buttons: only buttons valid
+};
+
+/// \brief Receive stream packets and supervise the link. Call from main loop.
+///
+/// While the mouse boots, and when it is replugged or stops responding and has to
+/// be reset and configured again, this advances that instead.
+/// A button change is reported as soon as the first byte of its packet is in,
+/// and again with the complete packet.
+/// \param movt decoded movement, valid as the result tells
+/// \return see _mouse_poll
+uint8_t mouse_poll(DecodedMovt *movt);
+
+/// \brief Decode raw 3-byte movement packet.
+void mouse_decode(MouseMovt *packet, DecodedMovt *movt);
+
+/// \brief Enable or disable adaptive sample rate. Disabled, the rate returns to 100/s.
+/// \param on 1 = follow motion speed between 40 and 200 reports/s
+void mouse_autorate(uint8_t on);
+
+/// Link test patterns, see mouse_linktest()
+enum _linktest_patterns {
+    LINKTEST_ALTERNATE = 1,         ///< 0x55 and 0xaa, every bit toggles
+    LINKTEST_WALKING = 2,           ///< walking one, walking zero
+    LINKTEST_COUNT = 4,             ///< counting up
+    LINKTEST_RANDOM = 8,            ///< pseudo-random, same sequence every time
+    LINKTEST_ALL = 15,              ///< all of the above
+};
+
+/// \brief Measure link quality with the mouse in wrap (echo) mode.
+///
+/// Every byte goes out with ps2_sendbyte() and comes back through the receive path.
+/// Prints round-trip time per byte, mouse clock rate, error counts and retransmits,
+/// then puts the mouse back into stream mode. Blocks for about 3ms per byte.
+/// \param count bytes per pattern
+/// \param patterns LINKTEST_ pattern bits
+void mouse_linktest(uint16_t count, uint8_t patterns);
 
 /// \brief Set mouse resolution
 /// \param res resolution code
@@ -0,0 +1,128 @@
+///\file
+///\brief Lightweight typed output
+///
+/// Decimal digits come from subtracting powers of ten, at most 9 subtractions per
+/// digit, which is far cheaper than 16-bit division on a part without a divider.
+/// Numbers are built in a small buffer on the stack and then sent, a character
+/// at a time, through the output function.
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#include "usrat.h"
+#include "out.h"
+
+static OutFunc out_put = uart_putchar;     ///< Where characters go
+
+static const uint16_t pow10[] PROGMEM = {10000, 1000, 100, 10, 1};
+
+void out_redirect(OutFunc put) {
+    out_put = put ? put : uart_putchar;
+}
+
+void out_char(char c) {
+    out_put(c);
+}
+
+void out_str_P(PGM_P s) {
+    char c;
+
+    while ((c = pgm_read_byte(s++)) != 0) out_put(c);
+}
+
+void out_line_P(PGM_P s) {
+    out_str_P(s);
+    out_put('\n');
+}
+
+/// Send buffer contents from p to end.
+static void out_buf(const char *p, const char *end) {
+    while (p < end) out_put(*p++);
+}
+
+void out_hex8(uint8_t v) {
+    char buf[2];
+
+    out_buf(buf, fmt_hex8(buf, v));
+}
+
+void out_udec(uint16_t v, uint8_t width) {
+    char buf[OUT_WIDTH_MAX];
+
+    out_buf(buf, fmt_udec(buf, v, width));
+}
+
+void out_sdec(int16_t v, uint8_t width, uint8_t plus) {
+    char buf[OUT_WIDTH_MAX];
+
+    out_buf(buf, fmt_sdec(buf, v, width, plus));
+}
+
+void out_cls() {
+    OUT_P("\033[2J\033[H");
+}
+
+void out_goto(uint8_t row, uint8_t col) {
+    char buf[10];
+
+    out_buf(buf, fmt_goto(buf, row, col));
+}
+
+/// Hex digit of low nibble
+static char hexdigit(uint8_t n) {
+    n &= 0x0f;
+    return n < 10 ? '0' + n : 'a' - 10 + n;
+}
+
+char *fmt_hex8(char *p, uint8_t v) {
+    *p++ = hexdigit(v >> 4);
+    *p++ = hexdigit(v);
+
+    return p;
+}
+
+/// \brief Decimal number with optional sign, right aligned.
+/// \param sign sign character or 0
+static char *fmt_dec(char *p, uint16_t u, char sign, uint8_t width) {
+    char digits[5];
+    uint8_t i, n, first = 4, len;
+    uint16_t pw;
+
+    for (i = 0; i < 5; i++) {
+        pw = pgm_read_word(&pow10[i]);
+        for (n = 0; u >= pw; n++) u -= pw;
+        digits[i] = '0' + n;
+        if (n && first == 4) first = i;
+    }
+
+    len = 5 - first + (sign != 0);
+    if (width > OUT_WIDTH_MAX) width = OUT_WIDTH_MAX;
+    for (; width > len; width--) *p++ = ' ';
+    if (sign) *p++ = sign;
+    for (i = first; i < 5; i++) *p++ = digits[i];
+
+    return p;
+}
+
+char *fmt_udec(char *p, uint16_t v, uint8_t width) {
+    return fmt_dec(p, v, 0, width);
+}
+
+char *fmt_sdec(char *p, int16_t v, uint8_t width, uint8_t plus) {
+    if (v < 0) return fmt_dec(p, -(uint16_t)v, '-', width);
+
+    return fmt_dec(p, (uint16_t)v, plus ? '+' : 0, width);
+}
+
+char *fmt_goto(char *p, uint8_t row, uint8_t col) {
+    *p++ = '\033';
+    *p++ = '[';
+    p = fmt_udec(p, row, 0);
+    *p++ = ';';
+    p = fmt_udec(p, col, 0);
+    *p++ = 'H';
+
+    return p;
+}
+
+//$Id$
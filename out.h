@@ -0,0 +1,70 @@
+///\file
+///\brief Lightweight typed output
+///
+/// Small replacement for printf_P() in diagnostics. Every function prints one value
+/// of one type, so arguments are checked by the compiler, and conversions are done
+/// without division. Output goes to uart_putchar() unless redirected.
+///
+/// The fmt_ functions format into a buffer for callers that need to know the length
+/// before sending, like VT-Paint. They return a pointer past the last character written.
+
+#ifndef _OUT_H
+#define _OUT_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#define OUT_WIDTH_MAX   8       ///< Widest decimal field
+
+/// Character output function
+typedef int (*OutFunc)(char c);
+
+/// \brief Send output somewhere else than the USART.
+/// \param put output function, 0 = back to uart_putchar()
+void out_redirect(OutFunc put);
+
+/// Print one character, '\n' becomes CR LF.
+void out_char(char c);
+
+/// Print string from program memory, like printf_P(s).
+void out_str_P(PGM_P s);
+
+/// Print string from program memory and a newline, like puts_P(s).
+void out_line_P(PGM_P s);
+
+/// Print string literal, kept in program memory.
+#define OUT_P(s)    out_str_P(PSTR(s))
+
+/// Print byte as two hex digits, like "%02x".
+void out_hex8(uint8_t v);
+
+/// \brief Print unsigned decimal, like "%*u".
+/// \param width field width, right aligned, at most OUT_WIDTH_MAX
+void out_udec(uint16_t v, uint8_t width);
+
+/// \brief Print signed decimal, like "%*d" or "%+*d".
+/// \param width field width, right aligned, at most OUT_WIDTH_MAX
+/// \param plus 1 = '+' sign for positive values
+void out_sdec(int16_t v, uint8_t width, uint8_t plus);
+
+/// Clear terminal screen and move cursor home.
+void out_cls();
+
+/// Move terminal cursor, rows and columns count from 1.
+void out_goto(uint8_t row, uint8_t col);
+
+/// Format two hex digits.
+char *fmt_hex8(char *p, uint8_t v);
+
+/// Format unsigned decimal in a field of width characters.
+char *fmt_udec(char *p, uint16_t v, uint8_t width);
+
+/// Format signed decimal in a field of width characters, see out_sdec().
+char *fmt_sdec(char *p, int16_t v, uint8_t width, uint8_t plus);
+
+/// Format "ESC [ row ; col H", 8 characters for rows and columns up to 99, at most 10.
+char *fmt_goto(char *p, uint8_t row, uint8_t col);
+
+#endif
+
+//$Id$
@@ -7,6 +7,13 @@
 /// Events not triggered by clock (end of transmission, transmission request, watchdog,
 /// error recovery) use Timer0. Watch out how state changes in different handlers.
 ///
+/// Reception is guarded by a frame watchdog too: if the clock stops in the middle of
+/// a byte (mouse unplugged, glitch counted as a start bit), the receiver doesn't hang
+/// mid-frame waiting for the rest but goes through error recovery.
+///
+/// Every error is counted by kind, for link diagnostics. Counting only happens
+/// on error paths.
+///
 
 #include <inttypes.h>
 #include <avr/io.h>
@@ -16,9 +23,32 @@
 #include <stdio.h>
 
 #include "ioconfig.h"
+#include "timing.h"
+#include "timebase.h"
+#include "ring.h"
 
 #include "ps2.h"
 
+#define T0_CS_8         2       ///< Timer0 clock select: clk/8
+#define T0_CS_256       4       ///< Timer0 clock select: clk/256
+
+#define PS2_RECOVER_US  1000    ///< Clock held low in error recovery
+#define PS2_REQ_US      128     ///< Clock held low before transmission (>= 100us)
+#define PS2_ACK_US      2       ///< Delay before checking for TX end after ACK
+#define PS2_TX_WDT_MS   163     ///< Transmission watchdog timeout
+#define PS2_RX_WDT_US   2000    ///< Reception watchdog: 11 bits at slowest 10kHz clock take 1.1ms
+#define PS2_SEND_MS     250     ///< ps2_sendbyte() gives up after this long
+
+STATIC_ASSERT(TIMER8_FITS(PS2_RECOVER_US, 256), ps2_recover_interval_unrepresentable);
+STATIC_ASSERT(TIMER8_FITS(PS2_REQ_US, 256), ps2_request_interval_unrepresentable);
+STATIC_ASSERT(TIMER8_FITS(PS2_ACK_US, 8), ps2_ack_interval_unrepresentable);
+STATIC_ASSERT(TIMER8_FITS(PS2_RX_WDT_US, 256), ps2_rx_watchdog_unrepresentable);
+
+/// Watchdog barks: full Timer0 periods at clk/256 in PS2_TX_WDT_MS
+#define PS2_TX_WDT_BARKS    (TIMER_TICKS(PS2_TX_WDT_MS * 1000UL, 256) / 256)
+
+STATIC_ASSERT(PS2_TX_WDT_BARKS >= 1 && PS2_TX_WDT_BARKS <= 255, ps2_watchdog_unrepresentable);
+
 /// Read PS2 data into bit 7
 #define ps2_datin() ((PS2PIN & _BV(PS2DAT)) ? 0200 : 0)
 
@@ -29,9 +59,8 @@
 static volatile uint8_t state;                  ///< PS2 protocol state
 
 static volatile uint8_t recv_byte;              ///< Byte being received
-static volatile uint8_t rx_head;                ///< Buffer head offset
-static volatile uint8_t rx_tail;                ///< Buffer tail offset
-static volatile uint8_t rx_buf[PS2_RXBUF_LEN];  ///< Receive buffer
+
+RING(rx, PS2_RXBUF_LEN);                        ///< Receive buffer, INT0 puts, main loop gets
 
 static volatile uint8_t tx_byte;                ///< Byte being transmitted
 
@@ -40,6 +69,11 @@ static volatile uint8_t bits = 0;
 static volatile uint8_t parity;
 
 static volatile uint8_t waitcnt = 0;
+static volatile uint8_t barkcnt = 0;            ///< Watchdog overflows left
+static volatile uint8_t tx_ok;                  ///< Last transmission completed
+
+static volatile PS2Stats stats;                 ///< Link error counters
+static volatile uint8_t rx_errors;              ///< Receive errors and dropped bytes, free-running
 
 /// PS2 protocol states
 enum _state {
@@ -64,24 +98,34 @@ void ps2_dat(uint8_t);              ///< Set dat
 
 uint8_t ps2_busy() { return state != IDLE; }
 
+void ps2_stats(PS2Stats *st, uint8_t clear) {
+    uint8_t sreg = SREG;
+    
+    cli();
+    *st = stats;
+    if (clear) stats = (PS2Stats){0};
+    SREG = sreg;
+    
+    ring_stats(&rx, &st->rx_buf, clear);
+}
+
 void ps2_init() {
     state = IDLE;
-    rx_head = 0;
-    rx_tail = 0;
+    ring_init(&rx);
     ps2_enable_recv(0);
     
     MCUCR |= _BV(ISC01); // falling edge for INT00
-    TIMSK &= ~_BV(TOIE0);
+    IO_CLR(TIMSK, _BV(TOIE0));
 }
 
 /// Begin error recovery: disable reception and wait for timer interrupt
 void ps2_recover() {
     if (state == ERROR) {
         ps2_enable_recv(0);
-        TCNT0 = 255-35; // approx 1ms
-        TIMSK |= _BV(TOIE0);
+        TCNT0 = TIMER8_RELOAD(PS2_RECOVER_US, 256);
+        IO_SET(TIMSK, _BV(TOIE0));
 
-        TCCR0 = 4;  // enable: clk/256
+        TCCR0 = T0_CS_256;  // enable: clk/256
     }
 }
 
@@ -89,12 +133,12 @@ void ps2_enable_recv(uint8_t enable) {
     if (enable) {
         state = IDLE;
         ps2_dir(1,1);
-        // enable INT0 interruptt
-        GIFR |= _BV(INTF0);
-        GICR |= _BV(INT0);
+        // enable INT0 interruptt; flags clear by writing 1, |= would clear them all
+        GIFR = _BV(INTF0);
+        IO_SET(GICR, _BV(INT0));
     } else {
         // disable INT0, then everything else
-        GICR &= ~_BV(INT0);
+        IO_CLR(GICR, _BV(INT0));
         ps2_clk(0);
         ps2_dir(1,0);
     }
@@ -113,38 +157,60 @@ void ps2_dat(uint8_t d) {
     d ? (PS2PORT |= _BV(PS2DAT)) : (PS2PORT &= ~_BV(PS2DAT));
 }
 
-uint8_t ps2_avail() {
-    return rx_head != rx_tail;
-} 
+uint8_t ps2_avail() {
+    return ring_count(&rx);
+}
+
+uint8_t ps2_rxerrors() {
+    return rx_errors;
+} 
+
+uint8_t ps2_getbyte() {
+    return ring_get(&rx);
+}
 
-uint8_t ps2_getbyte() {
-	uint8_t result = rx_buf[rx_tail];
-	rx_tail = (rx_tail + 1) % PS2_RXBUF_LEN;
-	
-	return result;
+/// \brief Wait until state machine is idle.
+/// \return 0 if idle, 1 if it got stuck and had to be forced into recovery
+static uint8_t ps2_waitidle(uint32_t start) {
+    while (state != IDLE) {
+        if (timebase_ms() - start > PS2_SEND_MS) {
+            // watchdogs should never let this happen
+            IO_CLR(GICR, _BV(INT0));
+            stats.tx_timeout++;
+            state = ERROR;
+            ps2_recover();
+            return 1;
+        }
+    }
+    return 0;
 }
 
-void ps2_sendbyte(uint8_t byte) {
-    while (state != IDLE);
+uint8_t ps2_sendbyte(uint8_t byte) {
+    uint32_t start = timebase_ms();
+    
+    if (ps2_waitidle(start)) return 1;
      
     // 1. pull clk low for 100us
     ps2_enable_recv(0);
 
     tx_byte = byte;
+    tx_ok = 0;
     state = TX_REQ0;
     
-    // 128us
-    TCNT0 = 255-4; 
-    TIMSK |= _BV(TOIE0);
-    TCCR0 = 4;
+    TCNT0 = TIMER8_RELOAD(PS2_REQ_US, 256); 
+    IO_SET(TIMSK, _BV(TOIE0));
+    TCCR0 = T0_CS_256;
+    
+    if (ps2_waitidle(start)) return 1;
     
-    while (state != IDLE);
+    return !tx_ok;
 }
 
 /// Happens every negative PS2 clock transition.
 ///
 /// ISR_NOBLOCK because nothing here is really critical, while C1351 emulation
-/// is really time critical. 
+/// is really time critical. Blocking handlers that change TIMSK can come in here,
+/// so TIMSK changes use IO_SET()/IO_CLR(). 
 ISR(INT0_vect, ISR_NOBLOCK) {
     uint8_t ps2_indat = ps2_datin();
     switch (state) {
@@ -159,7 +225,15 @@ ISR(INT0_vect, ISR_NOBLOCK) {
                 bits = 8;
                 parity = 0;
                 recv_byte = 0;
+                
+                // frame watchdog
+                barkcnt = 0;
+                TCNT0 = TIMER8_RELOAD(PS2_RX_WDT_US, 256);
+                IO_SET(TIMSK, _BV(TOIE0));
+                TCCR0 = T0_CS_256;
             } else {
+                stats.rx_framing++;
+                rx_errors++;
                 state = ERROR;
             }
             break;
@@ -176,15 +250,23 @@ ISR(INT0_vect, ISR_NOBLOCK) {
             if (parity) {
                 state = RX_STOP;
             } else {
+                stats.rx_parity++;
+                rx_errors++;
                 state = ERROR;
             }
             break;
         case RX_STOP:
             if (!ps2_indat) {
+                stats.rx_framing++;
+                rx_errors++;
                 state = ERROR;
             } else {
-                rx_buf[rx_head] = recv_byte;
-                rx_head = (rx_head + 1) % PS2_RXBUF_LEN;
+                // overflow is counted by the ring
+                if (ring_put(&rx, recv_byte)) rx_errors++;
+                
+                // stop frame watchdog
+                IO_CLR(TIMSK, _BV(TOIE0));
+                TCCR0 = 0;
                 
                 state = IDLE;                
             }
@@ -214,15 +296,16 @@ ISR(INT0_vect, ISR_NOBLOCK) {
             break;
         case TX_ACK:
             if (ps2_indat) {
+                stats.tx_noack++;
                 state = ERROR;
             } else {
                 // this will end in TMR0 interrupt
                 state = TX_END;                
 
                 waitcnt = 50;           // after 100us it's an error
-                TIMSK |= _BV(TOIE0);    // enable TMR0 interrupt
-                TCNT0 = 255-2;              // 4 counts: 2us
-                TCCR0 = 2;              // prescaler = f/8: go!
+                IO_SET(TIMSK, _BV(TOIE0));  // enable TMR0 interrupt
+                TCNT0 = TIMER8_RELOAD(PS2_ACK_US, 8);
+                TCCR0 = T0_CS_8;        // prescaler = f/8: go!
             }
             break;
         case TX_END:
@@ -232,27 +315,29 @@ ISR(INT0_vect, ISR_NOBLOCK) {
 }
 
 /// transmit timer and error recovery vector
-ISR(TIMER0_OVF_vect) {
-    static uint8_t barkcnt = 0;
-    
+///
+/// ISR_NOBLOCK like INT0, so the SID and NEOS strobe interrupts are not held off.
+/// Timer0 never overflows again within this handler. INT0 can come in: each case
+/// leaves Timer0 and the state alone before it enables INT0, and a watchdog
+/// bark looks at the state again with interrupts off.
+ISR(TIMER0_OVF_vect, ISR_NOBLOCK) {
     switch (state) {
         case ERROR:
-            state = IDLE;
+            // stop timer before INT0 may start the frame watchdog
+            IO_CLR(TIMSK, _BV(TOIE0));
+            TCCR0 = 0;
+            
             ps2_clk(0);
             ps2_dat(0);
             ps2_enable_recv(1);
-            
-            // stop timer
-            TIMSK &= ~_BV(TOIE0);
-            TCCR0 = 0;
             break;
         case TX_REQ0:
             // load the timer to serve as a watchdog
-            // after 20 barks this is an error
-            barkcnt = 20;
-            TIMSK |= _BV(TOIE0);    // enable TMR0 interrupt
-            TCNT0 = 0;//255;            // 20*255*256/8e6 == 163ms
-            TCCR0 = 4;               // prescaler = /256, go!
+            // after PS2_TX_WDT_MS this is an error
+            barkcnt = PS2_TX_WDT_BARKS;
+            IO_SET(TIMSK, _BV(TOIE0));  // enable TMR0 interrupt
+            TCNT0 = 0;              // full 256-count periods
+            TCCR0 = T0_CS_256;      // prescaler = /256, go!
 
             // waited for 100us after pulling clock low, pull data low
             ps2_dat(0);
@@ -261,23 +346,24 @@ ISR(TIMER0_OVF_vect) {
             // release the clock line
             ps2_dir(0,1); 
             
-            GIFR |= _BV(INTF0); // clear INT0 flag
-            GICR |= _BV(INT0);  // enable INT0 @(negedge clk)
-                        
             // see you in INT0 handler
             bits = 8;
             parity = 0;
-
             state = TX_DATA;
+            
+            GIFR = _BV(INTF0);  // clear INT0 flag only
+            IO_SET(GICR, _BV(INT0));  // enable INT0 @(negedge clk)
             break;
         case TX_END:
             // wait until both clk and dat are up, that will be all
             if (ps2_clkin() && ps2_datin()) {
-                TIMSK &= ~_BV(TOIE0);
+                IO_CLR(TIMSK, _BV(TOIE0));
                 TCCR0 = 0;
+                tx_ok = 1;
                 state = IDLE;
             } else {
                 if (waitcnt == 0) {
+                    stats.tx_timeout++;
                     state = ERROR;
                     ps2_recover();
                 } else {
@@ -287,7 +373,17 @@ ISR(TIMER0_OVF_vect) {
             break;
         default:
             // watchdog barked: probably not a mouse!
+            // or a frame stuck halfway in reception,
+            // unless INT0 has just finished it
+            cli();
+            if (state == IDLE || state == ERROR) break;
             if (barkcnt == 0) {
+                if (state >= TX_REQ0) {
+                    stats.tx_timeout++;
+                } else {
+                    stats.rx_timeout++;
+                    rx_errors++;
+                }
                 state = ERROR;
                 ps2_recover();
             } else {
@@ -6,17 +6,35 @@
 
 #include <inttypes.h>
 
+#include "ring.h"
+
+/// Link error counters, see ps2_stats()
+typedef struct _ps2stats {
+    uint16_t rx_framing;            ///< received frames with bad start or stop bit
+    uint16_t rx_parity;             ///< received frames with bad parity
+    uint16_t rx_timeout;            ///< received frames cut off by the frame watchdog
+    uint16_t tx_noack;              ///< transmissions the device didn't acknowledge
+    uint16_t tx_timeout;            ///< transmissions that timed out
+    RingStats rx_buf;               ///< receive buffer overflows and high water mark
+} PS2Stats;
+
 /// Init PS/2 related I/O and interrupts.
 void ps2_init();
 
-/// Check if the input buffer contains at least one byte.
+/// \brief Check if the input buffer contains at least one byte.
+/// \return number of bytes in the input buffer
 uint8_t ps2_avail();
 
 /// Get one byte from input buffer. ps_avail() must be checked before doing so.
 uint8_t ps2_getbyte();
 
-/// Transmit one byte and wait for completion.
-void ps2_sendbyte(uint8_t);
+/// \brief Count of frames lost to receive errors or a full buffer.
+/// Free-running and wraps, a change since an earlier call means the byte stream has a gap.
+uint8_t ps2_rxerrors();
+
+/// \brief Transmit one byte and wait for completion.
+/// \return 0 if transmitted and acknowledged by the device, 1 on error or timeout
+uint8_t ps2_sendbyte(uint8_t);
 
 /// Check if PS/2 statemachine is in IDLE state.
 uint8_t ps2_busy();
@@ -25,6 +43,11 @@ uint8_t ps2_busy();
 /// \param 1 = enable
 void ps2_enable_recv(uint8_t);
 
+/// \brief Get link error counters.
+/// \param st receives counters since ps2_init() or last clear
+/// \param clear 1 = start counting from zero
+void ps2_stats(PS2Stats *st, uint8_t clear);
+
 #endif
 
 //$Id$
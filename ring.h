@@ -0,0 +1,183 @@
+///\file
+///\brief Single-producer single-consumer byte ring buffer
+///
+/// One side, usually an interrupt handler, only puts bytes in, the other, usually the
+/// main loop, only takes them out. Each side writes its own index and only reads the
+/// other's. Indexes are single bytes, so they are read and written atomically, and no
+/// locking is needed. They run free and wrap at 256. The size is a power of two up to
+/// 128, so masking an index gives the slot, and the difference of the indexes is the
+/// fill level, full included: all slots are usable.
+///
+/// Ordering: the producer stores the byte before it publishes the new head, the
+/// consumer reads the byte before it releases the slot with the new tail. RING_BARRIER()
+/// keeps the compiler from moving buffer accesses across index updates. The AVR itself
+/// doesn't reorder memory accesses.
+///
+/// A byte put into a full ring is dropped and counted. The highest fill level is kept
+/// too, so buffer sizes can be checked against real traffic. Both are producer side.
+///
+/// Everything is inline: these run in interrupt handlers, where calling a function
+/// makes the handler save all call-clobbered registers.
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "timing.h"
+
+/// Compiler memory barrier, orders buffer accesses and index updates
+#define RING_BARRIER()  __asm__ __volatile__ ("" ::: "memory")
+
+/// Ring buffer, see RING()
+typedef struct _ring {
+    volatile uint8_t head;          ///< Next slot to put into, written by producer
+    volatile uint8_t tail;          ///< Next slot to take from, written by consumer
+    uint8_t mask;                   ///< Size - 1
+    uint8_t high;                   ///< Highest fill level, producer side
+    uint16_t overflows;             ///< Bytes dropped because the ring was full, producer side
+    uint8_t *buf;                   ///< Storage, size bytes
+} Ring;
+
+/// Overflow accounting, see ring_stats()
+typedef struct _ringstats {
+    uint16_t overflows;             ///< bytes dropped because the ring was full
+    uint8_t high;                   ///< highest fill level
+} RingStats;
+
+/// \brief Define a static ring buffer and its storage.
+/// Size must be a power of two from 2 to 128, or the build breaks.
+#define RING(name, size)                                                                \
+    STATIC_ASSERT((size) >= 2 && (size) <= 128 && ((size) & ((size) - 1)) == 0,         \
+                  name##_size_must_be_a_power_of_two_up_to_128);                       \
+    static uint8_t name##_buf[size];                                                    \
+    static Ring name = { 0, 0, (size) - 1, 0, 0, name##_buf }
+
+/// Empty the ring and clear its counters. Neither side may be using it meanwhile.
+static inline void ring_init(Ring *r) {
+    r->head = r->tail = 0;
+    r->high = 0;
+    r->overflows = 0;
+}
+
+/// Bytes in the ring.
+static inline uint8_t ring_count(Ring *r) {
+    return (uint8_t)(r->head - r->tail);
+}
+
+/// Bytes that can be put without overflow.
+static inline uint8_t ring_space(Ring *r) {
+    return r->mask + 1 - ring_count(r);
+}
+
+/// \brief Producer: put one byte.
+/// \return 0 if stored, 1 if the ring was full and the byte dropped
+static inline uint8_t ring_put(Ring *r, uint8_t b) {
+    uint8_t head = r->head;
+    uint8_t n = (uint8_t)(head - r->tail);
+
+    if (n > r->mask) {
+        if (r->overflows != 0xffff) r->overflows++;
+        return 1;
+    }
+
+    r->buf[head & r->mask] = b;
+    RING_BARRIER();
+    r->head = head + 1;
+
+    if (++n > r->high) r->high = n;
+
+    return 0;
+}
+
+/// \brief Producer: put up to len bytes, those that don't fit are dropped and counted.
+/// \return number of bytes stored
+static inline uint8_t ring_write(Ring *r, const uint8_t *src, uint8_t len) {
+    uint8_t head = r->head;
+    uint8_t n = (uint8_t)(head - r->tail);
+    uint8_t put = r->mask + 1 - n;
+    uint8_t i;
+
+    if (len > put) {
+        r->overflows += len - put;
+        if (r->overflows < len - put) r->overflows = 0xffff;
+    } else {
+        put = len;
+    }
+
+    for (i = 0; i < put; i++) r->buf[(uint8_t)(head + i) & r->mask] = src[i];
+    RING_BARRIER();
+    r->head = head + put;
+
+    n += put;
+    if (n > r->high) r->high = n;
+
+    return put;
+}
+
+/// Consumer: look at byte i from the oldest on without taking it, i < ring_count().
+static inline uint8_t ring_peek(Ring *r, uint8_t i) {
+    RING_BARRIER();
+    return r->buf[(uint8_t)(r->tail + i) & r->mask];
+}
+
+/// Consumer: take the oldest byte, the ring must not be empty.
+static inline uint8_t ring_get(Ring *r) {
+    uint8_t tail = r->tail;
+    uint8_t b;
+
+    // not before the caller has seen the byte arrive
+    RING_BARRIER();
+    b = r->buf[tail & r->mask];
+    RING_BARRIER();
+    r->tail = tail + 1;
+
+    return b;
+}
+
+/// Consumer: drop n bytes that have been looked at with ring_peek(), n <= ring_count().
+static inline void ring_skip(Ring *r, uint8_t n) {
+    RING_BARRIER();
+    r->tail += n;
+}
+
+/// \brief Consumer: take up to len bytes.
+/// \return number of bytes taken
+static inline uint8_t ring_read(Ring *r, uint8_t *dst, uint8_t len) {
+    uint8_t tail = r->tail;
+    uint8_t n = (uint8_t)(r->head - tail);
+    uint8_t i;
+
+    if (len > n) len = n;
+
+    RING_BARRIER();
+    for (i = 0; i < len; i++) dst[i] = r->buf[(uint8_t)(tail + i) & r->mask];
+    RING_BARRIER();
+    r->tail = tail + len;
+
+    return len;
+}
+
+/// \brief Get overflow accounting. Safe to call while the producer is running.
+/// \param st receives counters since ring_init() or last clear
+/// \param clear 1 = start counting from zero
+static inline void ring_stats(Ring *r, RingStats *st, uint8_t clear) {
+    uint8_t sreg = SREG;
+
+    cli();
+    RING_BARRIER();
+    st->overflows = r->overflows;
+    st->high = r->high;
+    if (clear) {
+        r->overflows = 0;
+        r->high = ring_count(r);
+    }
+    RING_BARRIER();
+    SREG = sreg;
+}
+
+#endif
+
+//$Id$
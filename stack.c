@@ -0,0 +1,70 @@
+///\file
+///\brief Stack and RAM high water mark
+///
+/// Before anything else runs, in .init1 where neither the stack pointer nor the zero
+/// register are set up yet, RAM from the end of static data up to the top of the stack
+/// is painted with STACK_CANARY. The stack overwrites paint as it grows, whoever
+/// pushes: main loop, an interrupt handler, or an ISR_NOBLOCK handler with others
+/// nested on top of it. What is still painted right above static data was never
+/// reached. stack_free() counts it from the bottom up, so that is the headroom
+/// left at the worst moment since reset. A pushed byte that happens to equal the
+/// canary at the very edge makes it look one byte smaller than it is.
+
+#include <inttypes.h>
+#include <avr/io.h>
+
+#include "out.h"
+#include "stack.h"
+
+#if STACK_CHECK
+
+extern uint8_t __data_start;        ///< First byte of static data
+extern uint8_t _end;                ///< Past last byte of static data
+extern uint8_t __stack;             ///< Initial stack pointer, top of RAM
+
+void stack_paint() __attribute__((naked, used, section(".init1")));
+
+/// Paint everything from _end to __stack. Runs before C runtime setup, so plain asm.
+void stack_paint() {
+    __asm__ __volatile__ (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "1:  st Z+, r24\n"
+        "    cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (STACK_CANARY));
+}
+
+uint16_t stack_static() {
+    return &_end - &__data_start;
+}
+
+uint16_t stack_free() {
+    const uint8_t *p = &_end;
+
+    while (p <= &__stack && *p == STACK_CANARY) p++;
+
+    return p - &_end;
+}
+
+uint16_t stack_max() {
+    return &__stack + 1 - &_end - stack_free();
+}
+
+void stack_report() {
+    OUT_P("\nRAM: static ");
+    out_udec(stack_static(), 0);
+    OUT_P(" stack max ");
+    out_udec(stack_max(), 0);
+    OUT_P(" free ");
+    out_udec(stack_free(), 0);
+    out_char('\n');
+}
+
+#endif
+
+//$Id$
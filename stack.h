@@ -0,0 +1,27 @@
+///\file
+///\brief Stack and RAM high water mark
+///
+/// Compiled in with 'make STACK_CHECK=1', otherwise empty.
+
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <inttypes.h>
+
+#define STACK_CANARY    0xc5        ///< Paint of RAM never touched
+
+/// Bytes of static data: .data, .bss and .noinit.
+uint16_t stack_static();
+
+/// \brief Deepest stack since reset, interrupt handlers nested on top included.
+uint16_t stack_max();
+
+/// \brief Smallest gap there has been between static data and stack.
+uint16_t stack_free();
+
+/// Print static data, deepest stack and free headroom.
+void stack_report();
+
+#endif
+
+//$Id$
@@ -1,12 +0,0 @@
-//!\file
-//!\brief An attempt to make a usable delay routine without inlining.
-//! 
-#ifndef _TDELAY_H
-#define _TDELAY_H
-
-void tdelay(uint16_t);
-
-#endif
-
-
-//$Id$
@@ -0,0 +1,166 @@
+///\file 
+///\brief Monotonic system timebase and software timers
+///
+/// Timer2 runs freely at clk/64. Every overflow adds its length in CPU cycles to
+/// a cycle accumulator and whole milliseconds are moved from it into a 32-bit
+/// millisecond counter, so the count is exact for any F_CPU that is a whole number
+/// of MHz. Readers combine the counter with the accumulator and TCNT2 
+/// atomically, which gives millisecond and microsecond time.
+///
+/// Software timers live in a small fixed table. They are one-shot or periodic,
+/// an expired one-shot timer keeps its slot and can be restarted. Timer
+/// callbacks run from timer_poll() in main loop context, never in an interrupt,
+/// so they can talk to the mouse. With a handful of timers a linear scan 
+/// once per millisecond is cheaper than a real timer wheel.
+///
+/// timebase_delay() is for the mouse protocol code that has to wait for replies:
+/// due timers are served while it waits.
+
+#include <inttypes.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "timebase.h"
+
+static volatile uint32_t ms_count;          ///< Whole milliseconds
+static volatile uint16_t ms_cycles;         ///< CPU cycles since ms_count was last bumped
+
+/// Software timer slot
+typedef struct _swtimer {
+    TimerFunc func;                         ///< Callback, 0 if slot is free
+    uint32_t deadline;                      ///< timebase_ms() of next call
+    uint16_t period;                        ///< 0 = one-shot
+    uint8_t armed;                          ///< Waiting for deadline
+} SwTimer;
+
+static SwTimer timers[TIMER_SLOTS];
+static uint32_t timer_last;                 ///< timebase_ms() at last scan
+static uint8_t timer_busy;                  ///< timer_poll() is running callbacks
+
+void timebase_init() {
+    ms_count = 0;
+    ms_cycles = 0;
+    TCNT2 = 0;
+    TIFR = _BV(TOV2);
+    TIMSK |= _BV(TOIE2);
+    TCCR2 = _BV(CS22);                      // prescaler = 64
+}
+
+/// \brief Atomic snapshot of the clock.
+/// \param cycles receives CPU cycles elapsed after returned millisecond count
+/// \return whole milliseconds
+static uint32_t timebase_read(uint16_t *cycles) {
+    uint8_t sreg = SREG;
+    uint32_t ms;
+    uint16_t c;
+    uint8_t cnt;
+    
+    cli();
+    ms = ms_count;
+    c = ms_cycles;
+    cnt = TCNT2;
+    // overflow that happened after cli() is not accounted yet
+    if ((TIFR & _BV(TOV2)) && cnt < 128) c += TIMEBASE_OVF_CYCLES;
+    SREG = sreg;
+    
+    *cycles = c + (uint16_t)cnt * TIMEBASE_PRESCALER;
+    return ms;
+}
+
+uint32_t timebase_ms() {
+    uint16_t c;
+    uint32_t ms = timebase_read(&c);
+    
+    while (c >= TIMEBASE_MS_CYCLES) {
+        c -= TIMEBASE_MS_CYCLES;
+        ms++;
+    }
+    return ms;
+}
+
+uint32_t timebase_us() {
+    uint16_t c;
+    uint32_t ms = timebase_read(&c);
+    
+    return ms * 1000 + c / TIMEBASE_US_CYCLES;
+}
+
+void timebase_delay(uint16_t ms) {
+    uint32_t start = timebase_ms();
+    
+    while (timebase_ms() - start < ms) {
+        timer_poll();
+    }
+}
+
+uint8_t timer_start(TimerFunc func, uint16_t ms, uint16_t period) {
+    uint8_t i;
+    
+    for (i = 0; i < TIMER_SLOTS; i++) {
+        if (timers[i].func == 0) {
+            timers[i].deadline = timebase_ms() + ms;
+            timers[i].period = period;
+            timers[i].armed = 1;
+            timers[i].func = func;
+            return i;
+        }
+    }
+    return TIMER_NONE;
+}
+
+void timer_restart(uint8_t id, uint16_t ms) {
+    if (id < TIMER_SLOTS) {
+        timers[id].deadline = timebase_ms() + ms;
+        timers[id].armed = 1;
+    }
+}
+
+void timer_stop(uint8_t id) {
+    if (id < TIMER_SLOTS) timers[id].func = 0;
+}
+
+void timer_poll() {
+    uint32_t now = timebase_ms();
+    TimerFunc func;
+    uint8_t i;
+    
+    // nothing can expire within the same millisecond; callbacks that wait don't nest
+    if (now == timer_last || timer_busy) return;
+    timer_last = now;
+    timer_busy = 1;
+    
+    for (i = 0; i < TIMER_SLOTS; i++) {
+        func = timers[i].func;
+        if (func == 0 || !timers[i].armed || (int32_t)(now - timers[i].deadline) < 0) continue;
+        
+        if (timers[i].period) {
+            timers[i].deadline += timers[i].period;
+            // don't try to catch up after a long stall
+            if ((int32_t)(now - timers[i].deadline) >= 0) timers[i].deadline = now + timers[i].period;
+        } else {
+            timers[i].armed = 0;
+        }
+        func();
+    }
+    
+    timer_busy = 0;
+}
+
+/// TIMER2 Overflow vector
+///
+/// Moves whole milliseconds from cycle accumulator to millisecond counter.
+/// ISR_NOBLOCK so that it never delays the SID measurement interrupt.
+ISR(TIMER2_OVF_vect, ISR_NOBLOCK) {
+    uint16_t c = ms_cycles + TIMEBASE_OVF_CYCLES;
+    uint32_t ms = ms_count;
+    
+    while (c >= TIMEBASE_MS_CYCLES) {
+        c -= TIMEBASE_MS_CYCLES;
+        ms++;
+    }
+    ms_cycles = c;
+    ms_count = ms;
+}
+
+//$Id$
@@ -0,0 +1,64 @@
+///\file
+///\brief Monotonic system timebase and software timers
+#ifndef _TIMEBASE_H
+#define _TIMEBASE_H
+
+#include <inttypes.h>
+
+#include "timing.h"
+
+/// Timer2 prescaler
+#define TIMEBASE_PRESCALER  64
+
+/// CPU cycles per Timer2 overflow
+#define TIMEBASE_OVF_CYCLES (256UL * TIMEBASE_PRESCALER)
+
+/// CPU cycles per millisecond
+#define TIMEBASE_MS_CYCLES  ((F_CPU)/1000)
+
+/// CPU cycles per microsecond
+#define TIMEBASE_US_CYCLES  ((F_CPU)/1000000)
+
+STATIC_ASSERT((F_CPU) % 1000000UL == 0, timebase_needs_whole_mhz_clock);
+STATIC_ASSERT(TIMEBASE_MS_CYCLES + 2 * TIMEBASE_OVF_CYCLES < 65536UL, timebase_cycle_count_fits_16_bits);
+
+#define TIMER_SLOTS         4       ///< Number of software timers
+#define TIMER_NONE          0xff    ///< Invalid timer handle
+
+/// Software timer callback
+typedef void (*TimerFunc)();
+
+/// Start Timer2 as free-running timebase.
+void timebase_init();
+
+/// \brief Milliseconds since timebase_init(). Safe to call with interrupts disabled.
+uint32_t timebase_ms();
+
+/// \brief Microseconds since timebase_init(), wraps every 71 minutes. 
+/// Resolution is TIMEBASE_PRESCALER CPU cycles.
+uint32_t timebase_us();
+
+/// \brief Wait for given number of milliseconds.
+///
+/// Due software timers keep running meanwhile, unless the wait happens in a timer callback.
+void timebase_delay(uint16_t ms);
+
+/// \brief Start software timer.
+/// \param func callback, called from timer_poll()
+/// \param ms milliseconds until first call
+/// \param period 0 for one-shot timer, otherwise milliseconds between calls
+/// \return timer handle or TIMER_NONE if all slots are taken
+uint8_t timer_start(TimerFunc func, uint16_t ms, uint16_t period);
+
+/// \brief Rearm timer to expire ms milliseconds from now.
+void timer_restart(uint8_t id, uint16_t ms);
+
+/// \brief Stop timer and free its slot.
+void timer_stop(uint8_t id);
+
+/// \brief Call callbacks of expired timers. Call this from the main loop.
+void timer_poll();
+
+#endif
+
+//$Id$
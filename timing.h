@@ -0,0 +1,53 @@
+///\file
+///\brief Timer intervals derived from F_CPU
+///
+/// Every timer reload and prescaler-dependent constant in the firmware is
+/// derived here at compile time, so the adapter can be built for 8, 16 or 20 MHz
+/// by changing F_CPU in the Makefile. Intervals that can't be represented
+/// with the chosen prescaler break the build via STATIC_ASSERT().
+///
+/// The macros expand to constant expressions: use them with constant
+/// arguments only, otherwise they drag 64-bit arithmetic into the code.
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include <inttypes.h>
+
+#ifndef F_CPU
+#error F_CPU must be defined
+#endif
+
+/// Compile-time assertion. msg must be a valid identifier.
+#define STATIC_ASSERT(cond, msg) typedef char static_assert_##msg[(cond) ? 1 : -1]
+
+/// Number of timer ticks in us microseconds at prescaler presc, rounded
+#define TIMER_TICKS(us, presc)  \
+    ((uint32_t)((((unsigned long long)(F_CPU)/(presc)) * (us) + 500000ULL) / 1000000ULL))
+
+/// True if interval of us microseconds fits into an 8-bit timer at prescaler presc
+#define TIMER8_FITS(us, presc)  (TIMER_TICKS(us, presc) >= 1 && TIMER_TICKS(us, presc) <= 256)
+
+/// Reload value for an 8-bit timer to overflow after us microseconds
+#define TIMER8_RELOAD(us, presc) ((uint8_t)(256 - TIMER_TICKS(us, presc)))
+
+/// Timer1 prescaler used for SID measurement cycle timing
+#define T1_PRESCALER    8
+
+/// Timer1 clock select bits matching T1_PRESCALER
+#define T1_CS           _BV(CS11)
+
+/// Timer1 ticks per second
+#define T1_HZ           ((F_CPU)/(T1_PRESCALER))
+
+/// Timer1 ticks in us microseconds
+#define T1_US(us)       TIMER_TICKS(us, T1_PRESCALER)
+
+/// Timer1 clock select for unprescaled, high-resolution pot timing
+#define T1_CS_HIRES     _BV(CS10)
+
+STATIC_ASSERT(T1_HZ % 100000UL == 0, timer1_resolution_must_be_a_multiple_of_10us);
+
+#endif
+
+//$Id$
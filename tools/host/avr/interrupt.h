@@ -0,0 +1,17 @@
+///\file
+///\brief Host stand-in for avr/interrupt.h
+///
+/// ISR(vector) becomes a plain function named after the vector,
+/// so a host tool can call the handler directly.
+
+#ifndef _HOST_AVR_INTERRUPT_H
+#define _HOST_AVR_INTERRUPT_H
+
+#define ISR(vector, ...)    void vector(void); void vector(void)
+#define ISR_NOBLOCK
+#define sei()
+#define cli()
+
+#endif
+
+//$Id$
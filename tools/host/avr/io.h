@@ -0,0 +1,125 @@
+///\file
+///\brief Host stand-in for avr/io.h
+///
+/// Lets firmware modules compile on the build machine for host-side tools.
+/// I/O registers of ATmega8 become plain variables, defined in avr_regs.c.
+/// The tool owns them: it feeds PINx and acts on what the firmware writes.
+
+#ifndef _HOST_AVR_IO_H
+#define _HOST_AVR_IO_H
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+
+/// ATmega8 I/O registers: R8(name) for 8-bit, R16(name) for 16-bit ones
+#define HOST_AVR_REGS(R8, R16)                                              \
+    R8(GICR) R8(GIFR) R8(MCUCR) R8(TIMSK) R8(TIFR) R8(SREG)                 \
+    R8(TCCR0) R8(TCNT0)                                                     \
+    R8(TCCR1A) R8(TCCR1B) R16(TCNT1) R16(OCR1A) R16(OCR1B) R16(ICR1)        \
+    R8(TCCR2) R8(TCNT2) R8(OCR2) R8(ASSR)                                   \
+    R8(UCSRA) R8(UCSRB) R8(UCSRC) R8(UBRRH) R8(UBRRL) R8(UDR)               \
+    R8(PORTB) R8(DDRB) R8(PINB)                                             \
+    R8(PORTC) R8(DDRC) R8(PINC)                                             \
+    R8(PORTD) R8(DDRD) R8(PIND)                                             \
+    R8(ACSR) R8(SFIOR) R8(ADMUX) R8(ADCSRA)                                 \
+    R8(SPH) R8(SPL)
+
+#define HOST_R8_DECL(n)     extern volatile uint8_t n;
+#define HOST_R16_DECL(n)    extern volatile uint16_t n;
+HOST_AVR_REGS(HOST_R8_DECL, HOST_R16_DECL)
+
+#define RAMEND  0x45F
+
+// GICR, GIFR, MCUCR
+#define INT1    7
+#define INT0    6
+#define INTF1   7
+#define INTF0   6
+#define SE      7
+#define ISC11   3
+#define ISC10   2
+#define ISC01   1
+#define ISC00   0
+
+// TIMSK, TIFR
+#define OCIE2   7
+#define TOIE2   6
+#define TICIE1  5
+#define OCIE1A  4
+#define OCIE1B  3
+#define TOIE1   2
+#define TOIE0   0
+#define OCF2    7
+#define TOV2    6
+#define ICF1    5
+#define OCF1A   4
+#define OCF1B   3
+#define TOV1    2
+#define TOV0    0
+
+// TCCR0
+#define CS02    2
+#define CS01    1
+#define CS00    0
+
+// TCCR1A, TCCR1B
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+#define FOC1A   3
+#define FOC1B   2
+#define WGM11   1
+#define WGM10   0
+#define ICNC1   7
+#define ICES1   6
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+// TCCR2
+#define FOC2    7
+#define WGM20   6
+#define COM21   5
+#define COM20   4
+#define WGM21   3
+#define CS22    2
+#define CS21    1
+#define CS20    0
+
+// USART
+#define RXC     7
+#define TXC     6
+#define UDRE    5
+#define FE      4
+#define DOR     3
+#define PE      2
+#define U2X     1
+#define RXCIE   7
+#define TXCIE   6
+#define UDRIE   5
+#define RXEN    4
+#define TXEN    3
+#define URSEL   7
+#define USBS    3
+#define UCSZ1   2
+#define UCSZ0   1
+
+// ACSR, SFIOR, ADCSRA
+#define ACD     7
+#define ACBG    6
+#define ACO     5
+#define ACI     4
+#define ACIE    3
+#define ACIC    2
+#define ACIS1   1
+#define ACIS0   0
+#define ACME    3
+#define ADEN    7
+
+#endif
+
+//$Id$
@@ -0,0 +1,19 @@
+///\file
+///\brief Host stand-in for avr/pgmspace.h
+
+#ifndef _HOST_AVR_PGMSPACE_H
+#define _HOST_AVR_PGMSPACE_H
+
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define PGM_P               const char *
+#define printf_P            printf
+#define puts_P              puts
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+
+#endif
+
+//$Id$
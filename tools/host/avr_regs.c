@@ -0,0 +1,10 @@
+///\file
+///\brief I/O register variables for host builds, see avr/io.h
+
+#include <avr/io.h>
+
+#define HOST_R8_DEF(n)      volatile uint8_t n;
+#define HOST_R16_DEF(n)     volatile uint16_t n;
+HOST_AVR_REGS(HOST_R8_DEF, HOST_R16_DEF)
+
+//$Id$
@@ -0,0 +1,587 @@
+#!/usr/bin/env python3
+"""Static worst-case cycle analysis of interrupt handlers
+
+Reads avr-objdump disassembly of the firmware (mouse.lst) and, for every
+interrupt vector that has a handler, walks all paths through the handler and
+the functions it calls, counting ATmega8 cycles per instruction. Reported:
+
+ - wcet:    worst-case cycles from interrupt request to the end of reti,
+            including the 4-cycle response and the jump in the vector table
+ - masked:  longest stretch with global interrupts disabled: from the request
+            to the first sei, and any cli ... sei or SREG restore inside
+
+The instruction that is executing when the request comes adds up to 3 more
+cycles to the latency and is not included.
+
+Called functions are analysed in their calling context. Global interrupt state
+is followed through cli, sei and SREG save/restore, also via push/pop. Jump
+tables that avr-gcc builds for switch statements (ijmp into a table of rjmp)
+are resolved. Loops need a bound: the maximal number of times the loop's back
+edge is taken, given per function with -l NAME=N. Known libgcc routines have
+built-in bounds. A loop without a bound is counted as one iteration and the
+result is marked with '+'.
+
+-b VECTOR:REGISTER:CYCLES checks that every path from the VECTOR request to the
+last write of REGISTER in its handler takes at most CYCLES. Exit status is 1
+if a budget is exceeded or can't be established.
+
+-L VECTOR:REG:US[:EXCLUDED,...] checks the whole latency from the VECTOR request
+to that write, in microseconds, including the time the request is held off:
+up to 3 cycles for the instruction executing, the longest masked stretch of
+any other handler that may be running, and the masked stretch of every
+handler of higher priority, which may all be pending and are served first.
+Handlers listed as EXCLUDED are assumed never to run at the same time.
+Critical sections of the main loop are not included. -w FILE writes the
+holdoff and the request-to-write cycles of the -L vector as options for
+tools/neosread, which plays the C64 against them.
+
+Only checked against hand-made listings so far, not yet on avr-objdump output
+of the firmware, so the Makefile runs it on request only ('make timing').
+
+Usage: isrtiming.py [-f F_CPU] [-l NAME=N]... [-b VECTOR:REG:CYCLES]...
+                    [-L VECTOR:REG:US[:EXCLUDED,...]] [-w FILE] [-v] mouse.lst
+"""
+
+import argparse
+import re
+import sys
+import threading
+
+# ATmega8 interrupt vectors
+VECTORS = {
+    1: "INT0", 2: "INT1", 3: "TIMER2_COMP", 4: "TIMER2_OVF", 5: "TIMER1_CAPT",
+    6: "TIMER1_COMPA", 7: "TIMER1_COMPB", 8: "TIMER1_OVF", 9: "TIMER0_OVF",
+    10: "SPI_STC", 11: "USART_RXC", 12: "USART_UDRE", 13: "USART_TXC",
+    14: "ADC", 15: "EE_RDY", 16: "ANA_COMP", 17: "TWI", 18: "SPM_RDY",
+}
+
+# I/O register addresses for budgets, ATmega8
+IOREGS = {
+    "SREG": 0x3f, "GICR": 0x3b, "GIFR": 0x3a, "TIMSK": 0x39, "TIFR": 0x38,
+    "MCUCR": 0x35, "TCCR0": 0x33, "TCNT0": 0x32, "TCCR1A": 0x2f, "TCCR1B": 0x2e,
+    "TCNT1H": 0x2d, "TCNT1L": 0x2c, "OCR1AH": 0x2b, "OCR1AL": 0x2a,
+    "OCR1BH": 0x29, "OCR1BL": 0x28, "TCCR2": 0x25, "TCNT2": 0x24,
+    "PORTB": 0x18, "DDRB": 0x17, "PINB": 0x16, "PORTC": 0x15, "DDRC": 0x14,
+    "PINC": 0x13, "PORTD": 0x12, "DDRD": 0x11, "PIND": 0x10,
+    "UDR": 0x0c, "UCSRA": 0x0b, "UCSRB": 0x0a,
+}
+
+SREG = 0x3f
+RESPONSE_CYCLES = 4
+INSN_CYCLES = 3         # longest instruction the request may have to wait for
+
+# Back edge bounds of libgcc routines
+LIBGCC_LOOPS = {
+    "__udivmodqi4": 8, "__divmodqi4": 8,
+    "__udivmodhi4": 16, "__divmodhi4": 16,
+    "__udivmodsi4": 32, "__divmodsi4": 32,
+    "__mulsi3": 32, "__mulhi3": 16, "__mulqi3": 8,
+}
+
+# Cycles of instructions that don't change flow, when not listed: 1
+CYCLES = {
+    "adiw": 2, "sbiw": 2, "mul": 2, "muls": 2, "mulsu": 2,
+    "fmul": 2, "fmuls": 2, "fmulsu": 2,
+    "ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2,
+    "push": 2, "pop": 2, "sbi": 2, "cbi": 2,
+    "lpm": 3, "elpm": 3, "spm": 4,
+}
+
+BRANCHES = {
+    "brbs", "brbc", "breq", "brne", "brcs", "brcc", "brsh", "brlo", "brmi",
+    "brpl", "brge", "brlt", "brhs", "brhc", "brts", "brtc", "brvs", "brvc",
+    "brie", "brid",
+}
+
+SKIPS = {"cpse", "sbrc", "sbrs", "sbic", "sbis"}
+
+# Instructions that don't write their first register operand
+NO_WRITE = {
+    "out", "st", "std", "sts", "push", "cp", "cpc", "cpi", "cpse", "tst",
+    "sbrc", "sbrs", "sbic", "sbis", "sbi", "cbi", "bst", "spm",
+} | BRANCHES
+
+INSN_RE = re.compile(r"^\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )+)\s*([a-z]+)\s*([^;]*?)\s*(?:;\s*(.*))?$")
+SYM_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:\s*$")
+TARGET_RE = re.compile(r"0x([0-9a-f]+)")
+
+
+class Insn:
+    def __init__(self, addr, size, op, args, comment):
+        self.addr = addr
+        self.size = size
+        self.op = op
+        self.args = [a.strip() for a in args.split(",")] if args else []
+        self.comment = comment or ""
+
+    def target(self):
+        m = TARGET_RE.search(self.comment)
+        if m:
+            return int(m.group(1), 16)
+        if self.args and self.args[0].startswith("0x"):
+            return int(self.args[0], 16)
+        raise AnalysisError("no target for %s at 0x%x" % (self.op, self.addr))
+
+    def reg(self, i):
+        if i < len(self.args) and re.match(r"^r\d+$", self.args[i]):
+            return int(self.args[i][1:])
+        return None
+
+    def imm(self, i):
+        return int(self.args[i], 0)
+
+    def __str__(self):
+        return "%x: %s %s" % (self.addr, self.op, ", ".join(self.args))
+
+
+class AnalysisError(Exception):
+    pass
+
+
+class Program:
+    def __init__(self, lines):
+        self.insns = {}
+        self.symbols = []
+        for line in lines:
+            m = SYM_RE.match(line)
+            if m:
+                self.symbols.append((int(m.group(1), 16), m.group(2)))
+                continue
+            m = INSN_RE.match(line)
+            if m:
+                addr = int(m.group(1), 16)
+                size = len(m.group(2).split())
+                self.insns[addr] = Insn(addr, size, m.group(3), m.group(4), m.group(5))
+        self.symbols.sort()
+        if not self.insns:
+            raise AnalysisError("no instructions found")
+
+    def function_of(self, addr):
+        name = "?"
+        for a, n in self.symbols:
+            if a > addr:
+                break
+            name = n
+        return name
+
+    def symbol(self, name):
+        for a, n in self.symbols:
+            if n == name:
+                return a
+        return None
+
+    def at(self, addr):
+        try:
+            return self.insns[addr]
+        except KeyError:
+            raise AnalysisError("no instruction at 0x%x" % addr)
+
+    def vectors(self):
+        """Yield (number, name, handler address) for vectors with handlers"""
+        base = self.symbol("__vectors")
+        if base is None:
+            raise AnalysisError("no __vectors")
+        first = self.at(base)
+        step = first.size
+        bad = self.symbol("__bad_interrupt")
+        n = 1
+        while base + n * step in self.insns:
+            insn = self.insns[base + n * step]
+            if insn.op not in ("rjmp", "jmp"):
+                break
+            target = insn.target()
+            if target != bad and n in VECTORS:
+                yield n, VECTORS[n], insn, target
+            n += 1
+            if n > max(VECTORS):
+                break
+
+    def jump_table(self, insn):
+        """Targets of ijmp into a table of rjmp set up with subi/sbci r30/r31,
+        as many as the range check before it allows"""
+        lo = hi = count = None
+        addr = insn.addr
+        for _ in range(12):
+            prev = [i for i in (self.insns.get(addr - 2), self.insns.get(addr - 4)) if i and i.addr + i.size == addr]
+            if not prev:
+                break
+            p = prev[0]
+            addr = p.addr
+            if p.op == "subi" and p.reg(0) == 30 and lo is None:
+                lo = p.imm(1)
+            elif p.op == "sbci" and p.reg(0) == 31 and hi is None:
+                hi = p.imm(1)
+            elif p.op == "cpi" and count is None:
+                count = p.imm(1)
+                break
+        if lo is None or hi is None:
+            raise AnalysisError("unresolved indirect jump at 0x%x" % insn.addr)
+        table = ((-((hi << 8) | lo)) & 0xffff) * 2
+        targets = []
+        while table in self.insns and self.insns[table].op == "rjmp":
+            targets.append(table)
+            table += 2
+            if count is not None and len(targets) == count:
+                break
+        if not targets:
+            raise AnalysisError("no jump table for ijmp at 0x%x" % insn.addr)
+        return targets
+
+
+class Context:
+    """Flow successors of an instruction in a call context"""
+
+    def __init__(self, prog):
+        self.prog = prog
+
+    def successors(self, addr, calls):
+        """List of (addr, calls, cycles, kind), addr None for handler exit"""
+        prog = self.prog
+        insn = prog.at(addr)
+        op = insn.op
+        nxt = addr + insn.size
+        if op in BRANCHES:
+            return [(nxt, calls, 1, None), (insn.target(), calls, 2, None)]
+        if op in SKIPS:
+            skipped = prog.at(nxt)
+            return [(nxt, calls, 1, None), (nxt + skipped.size, calls, 3 if skipped.size == 4 else 2, None)]
+        if op in ("rjmp", "jmp"):
+            return [(insn.target(), calls, 2 if op == "rjmp" else 3, None)]
+        if op in ("rcall", "call"):
+            if len(calls) > 16:
+                raise AnalysisError("call depth exceeded at 0x%x, recursion?" % addr)
+            return [(insn.target(), calls + (nxt,), 3 if op == "rcall" else 4, None)]
+        if op == "ijmp":
+            return [(t, calls, 2, None) for t in prog.jump_table(insn)]
+        if op in ("icall", "eicall", "eijmp"):
+            raise AnalysisError("unresolved indirect call at 0x%x" % addr)
+        if op == "ret":
+            if not calls:
+                raise AnalysisError("ret without call at 0x%x" % addr)
+            return [(calls[-1], calls[:-1], 4, None)]
+        if op == "reti":
+            return [(None, calls, 4, None)]
+        return [(nxt, calls, CYCLES.get(op, 1), None)]
+
+
+class Handler:
+    """Worst-case analysis of one interrupt handler"""
+
+    def __init__(self, prog, entry, bounds, marker=None):
+        self.prog = prog
+        self.flow = Context(prog)
+        self.entry = entry
+        self.bounds = bounds
+        self.marker = marker
+        self.unbounded = set()
+        self.memo = {}
+        self.find_loops()
+
+    def find_loops(self):
+        """Back edges and natural loop bodies over (addr, calls) contexts"""
+        start = (self.entry, ())
+        preds = {start: set()}
+        self.back = {}
+        onstack = {start}
+        stack = [(start, iter(self.flow.successors(*start)))]
+        seen = {start}
+        while stack:
+            node, it = stack[-1]
+            for a, calls, _, _ in it:
+                if a is None:
+                    continue
+                succ = (a, calls)
+                preds.setdefault(succ, set()).add(node)
+                if succ in onstack:
+                    self.back[(node, succ)] = None
+                elif succ not in seen:
+                    seen.add(succ)
+                    onstack.add(succ)
+                    stack.append((succ, iter(self.flow.successors(*succ))))
+                    break
+            else:
+                stack.pop()
+                onstack.discard(node)
+
+        self.loop_ids = {}
+        self.bodies = []
+        for n, (u, h) in enumerate(self.back):
+            body = {h, u}
+            work = [u]
+            while work:
+                x = work.pop()
+                for p in preds.get(x, ()):
+                    if p not in body:
+                        body.add(p)
+                        work.append(p)
+            self.loop_ids[(u, h)] = n
+            self.bodies.append(body)
+
+    def bound(self, header):
+        name = self.prog.function_of(header[0])
+        if name in self.bounds:
+            return self.bounds[name]
+        if name in LIBGCC_LOOPS:
+            return LIBGCC_LOOPS[name]
+        self.unbounded.add("%s at 0x%x" % (name, header[0]))
+        return 1
+
+    def step(self, state, succ, cycles):
+        """Next state after executing the instruction of state towards succ"""
+        (addr, calls), masked, saved, stack, counters = state
+        insn = self.prog.at(addr)
+        op = insn.op
+        saved = dict(saved)
+        stack = list(stack)
+
+        r = insn.reg(0)
+        if op == "cli":
+            masked = True
+        elif op == "sei":
+            masked = False
+        elif op == "in" and insn.imm(1) == SREG:
+            saved[r] = masked
+        elif op == "out" and insn.imm(0) == SREG:
+            if insn.reg(1) in saved:
+                masked = saved[insn.reg(1)]
+        elif op == "push":
+            stack.append(saved.get(r))
+        elif op == "pop":
+            v = stack.pop() if stack else None
+            saved.pop(r, None)
+            if v is not None:
+                saved[r] = v
+        elif op == "mov":
+            src = insn.reg(1)
+            saved.pop(r, None)
+            if src in saved:
+                saved[r] = saved[src]
+        elif op == "movw":
+            for k in (0, 1):
+                saved.pop(r + k, None)
+                if insn.reg(1) + k in saved:
+                    saved[r + k] = saved[insn.reg(1) + k]
+        elif r is not None and op not in NO_WRITE:
+            saved.pop(r, None)
+
+        node = (addr, calls)
+        counters = dict(counters)
+        if succ is not None:
+            edge = (node, succ)
+            if edge in self.loop_ids:
+                lid = self.loop_ids[edge]
+                if counters.get(lid, 0) >= self.bound(succ):
+                    return None
+                counters[lid] = counters.get(lid, 0) + 1
+            for lid in list(counters):
+                if node in self.bodies[lid] and succ not in self.bodies[lid]:
+                    del counters[lid]
+
+        return (succ, masked, tuple(sorted(saved.items())), tuple(stack), tuple(sorted(counters.items())))
+
+    def solve(self, state):
+        """(wcet to exit, cycles to marker, masked run from here, worst masked run below)"""
+        if state in self.memo:
+            return self.memo[state]
+        node, masked = state[0], state[1]
+        addr = node[0]
+        insn = self.prog.at(addr)
+        neg = float("-inf")
+        wcet, mark, run, window = neg, neg, 0, 0
+        for a, calls, cycles, _ in self.flow.successors(*node):
+            succ = (a, calls) if a is not None else None
+            nstate = self.step(state, succ, cycles)
+            if nstate is None:
+                continue
+            if succ is None:
+                w, m, r, win = 0, neg, 0, 0
+                nmasked = False
+            else:
+                w, m, r, win = self.solve(nstate)
+                nmasked = nstate[1]
+            wcet = max(wcet, cycles + w)
+            if self.marker is not None and addr == self.marker:
+                mark = max(mark, cycles)
+            else:
+                mark = max(mark, cycles + m)
+            if masked:
+                run = max(run, cycles + (r if nmasked else 0))
+            window = max(window, win)
+        if masked:
+            window = max(window, run)
+        result = (wcet, mark, run, window)
+        self.memo[state] = result
+        return result
+
+    def analyse(self, vector_cycles):
+        # the CPU clears I on entry
+        start = ((self.entry, ()), True, (), (), ())
+        wcet, mark, run, window = self.solve(start)
+        pre = RESPONSE_CYCLES + vector_cycles
+        return wcet + pre, (mark + pre if mark != float("-inf") else None), max(window, run + pre)
+
+
+def writes(insn, io):
+    if insn.op == "out" and insn.imm(0) == io:
+        return True
+    if insn.op == "sts" and insn.imm(0) == io + 0x20:
+        return True
+    return False
+
+
+def handler_extent(prog, entry):
+    """Addresses of the handler function: from entry to the next symbol"""
+    end = None
+    for a, n in prog.symbols:
+        if a > entry:
+            end = a
+            break
+    return [a for a in sorted(prog.insns) if a >= entry and (end is None or a < end)]
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Worst-case cycles of AVR interrupt handlers")
+    ap.add_argument("lst", help="avr-objdump disassembly")
+    ap.add_argument("-f", "--f-cpu", type=lambda s: float(s.rstrip("UuLl")), default=8e6, help="CPU clock, Hz")
+    ap.add_argument("-l", "--loop", action="append", default=[], metavar="NAME=N",
+                    help="loop bound for function or vector NAME")
+    ap.add_argument("-b", "--budget", action="append", default=[], metavar="VECTOR:REG:CYCLES",
+                    help="cycle budget from VECTOR request to last write of REG")
+    ap.add_argument("-L", "--latency", action="append", default=[], metavar="VECTOR:REG:US[:EXCLUDED,...]",
+                    help="latency limit from VECTOR request to last write of REG, other handlers included")
+    ap.add_argument("-w", "--write-neosread", metavar="FILE",
+                    help="write holdoff and handler cycles of the -L vector as neosread options")
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args()
+
+    try:
+        with open(args.lst) as f:
+            prog = Program(f)
+    except (OSError, AnalysisError) as e:
+        print("isrtiming: %s" % e, file=sys.stderr)
+        return 2
+
+    vectors = list(prog.vectors())
+    byname = {name: (n, insn, target) for n, name, insn, target in vectors}
+
+    bounds = {}
+    for spec in args.loop:
+        name, n = spec.split("=")
+        if name in byname:
+            name = prog.function_of(byname[name][2])
+        bounds[name] = int(n)
+
+    budgets = {}
+    for spec in args.budget:
+        vec, reg, cycles = spec.split(":")
+        budgets[vec] = (reg, int(cycles))
+
+    latencies = {}
+    for spec in args.latency:
+        vec, reg, limit = spec.split(":")[:3]
+        excluded = spec.split(":")[3].split(",") if spec.count(":") > 2 else []
+        latencies[vec] = (reg, float(limit), set(excluded))
+
+    markers = {}
+    for vec, (reg, _) in budgets.items():
+        markers[vec] = reg
+    for vec, (reg, _, _) in latencies.items():
+        if markers.setdefault(vec, reg) != reg:
+            print("isrtiming: %s: budget and latency for different registers" % vec, file=sys.stderr)
+            return 2
+
+    us = 1e6 / args.f_cpu
+    failed = 0
+    results = {}
+
+    print("%-13s %-16s %7s %9s %7s %9s" % ("vector", "handler", "wcet", "", "masked", ""))
+    for n, name, vinsn, target in vectors:
+        handler = prog.function_of(target)
+        vector_cycles = 2 if vinsn.op == "rjmp" else 3
+        marker = None
+        if name in markers:
+            reg = markers[name]
+            io = IOREGS.get(reg)
+            hits = [a for a in handler_extent(prog, target) if io is not None and writes(prog.at(a), io)]
+            marker = hits[-1] if hits else None
+        try:
+            h = Handler(prog, target, bounds, marker)
+            wcet, mark, window = h.analyse(vector_cycles)
+            if wcet == float("-inf"):
+                raise AnalysisError("no path reaches reti")
+        except AnalysisError as e:
+            print("%-13s %-16s %s" % (name, handler, e))
+            results[name] = None
+            if name in markers:
+                failed = 1
+            continue
+        results[name] = (mark, window, bool(h.unbounded))
+        flag = "+" if h.unbounded else " "
+        print("%-13s %-16s %6d%s %7.2f us %6d%s %7.2f us" %
+              (name, handler, wcet, flag, wcet * us, window, flag, window * us))
+        for u in sorted(h.unbounded):
+            print("%-13s   unbounded loop in %s, counted once" % ("", u))
+        if args.verbose:
+            print("%-13s   %d states, %d loops" % ("", len(h.memo), len(h.bodies)))
+
+        if name in budgets:
+            reg, limit = budgets[name]
+            if mark is None:
+                print("%-13s   no write of %s found" % ("", reg))
+                failed = 1
+                continue
+            ok = mark <= limit and not h.unbounded
+            print("%-13s   request to %s write: %d cycles (%.2f us), budget %d: %s" %
+                  ("", reg, mark, mark * us, limit, "OK" if ok else "OVER"))
+            if not ok:
+                failed = 1
+
+    for vec, (reg, limit, excluded) in latencies.items():
+        if results.get(vec) is None:
+            continue
+        mark, _, unbounded = results[vec]
+        if mark is None:
+            if vec not in budgets:
+                print("%-13s   no write of %s found" % (vec, reg))
+                failed = 1
+            continue
+        prio = byname[vec][0]
+        longest = higher = 0
+        for n, name, _, _ in vectors:
+            if name == vec or name in excluded:
+                continue
+            if results[name] is None:
+                unbounded = True
+                continue
+            _, window, ub = results[name]
+            unbounded = unbounded or ub
+            longest = max(longest, window)
+            if n < prio:
+                higher += window
+        holdoff = INSN_CYCLES + longest + higher
+        total = holdoff + mark
+        ok = total * us <= limit and not unbounded
+        print("%-13s   request to %s write with holdoff %d: %d cycles (%.2f us), limit %.2f us: %s" %
+              (vec, reg, holdoff, total, total * us, limit, "OK" if ok else "OVER"))
+        if not ok:
+            failed = 1
+        if args.write_neosread:
+            with open(args.write_neosread, "w") as f:
+                f.write("-o %d -c %d\n" % (holdoff, mark))
+
+    for vec in markers:
+        if vec not in byname:
+            print("isrtiming: no handler for %s" % vec, file=sys.stderr)
+            failed = 1
+
+    return failed
+
+
+if __name__ == "__main__":
+    sys.setrecursionlimit(200000)
+    threading.stack_size(256 << 20)
+    result = []
+    t = threading.Thread(target=lambda: result.append(main()))
+    t.start()
+    t.join()
+    sys.exit(result[0] if result else 2)
@@ -0,0 +1,317 @@
+///\file
+///\brief NEOS mouse mode against a simulated C64 driver
+///
+/// Runs the real c1351.c in NEOS mode on the build machine. Every change of the FIRE
+/// line, a wired AND of the C64 strobe output and the left button, raises the strobe
+/// interrupt. Other interrupts hold it off for a random 0 to -o cycles, then the
+/// handler runs, and what it writes to JOYDDR becomes visible to the C64 a handler
+/// delay later (-c, default the NEOS_BUDGET of the timing target). Timer1 is modelled
+/// as far as NEOS mode uses it: restarted by the handler, its compare flag set every
+/// NEOS_TIMEOUT_US after that and cleared by writing a one.
+///
+/// The C64 driver reads once per frame: XH, strobe high, XL, strobe low, YH,
+/// strobe high, YL, strobe low, waiting -d us after every strobe write. Some
+/// reads are abandoned after one to three nibbles and some are stretched past
+/// NEOS_TIMEOUT_US. Meanwhile the main loop reports random motion every 10ms,
+/// some of it larger than one NEOS delta, and calls potmouse_poll().
+///
+/// Reported:
+///  - latency: time from strobe edge to the new nibble on the lines, and what is
+///    left of the C64's wait
+///  - late reads: nibbles read before they were on the lines
+///  - balance: motion reported minus motion the C64 has decoded, after motion stops.
+///    Anything but 0 means lost, doubled or torn deltas.
+///
+/// Usage: neosread [-n reads] [-d us] [-c cycles] [-o cycles] [-s seed] [-v]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "ioconfig.h"
+#include "timing.h"
+#include "c1351.h"
+
+void ANA_COMP_vect(void);
+
+#define NS_PER_CYCLE    (1e9 / (F_CPU))
+#define FRAME_NS        20000000LL      ///< C64 reads once per PAL frame
+#define REPORT_NS       10000000LL      ///< PS/2 report interval
+#define MAINLOOP_NS     100000LL        ///< potmouse_poll() interval
+#define SETTLE_READS    200             ///< reads after motion has stopped
+#define C64_WAIT_US     20.0            ///< driver's wait after a strobe write
+#define BUCKET_US       2.5             ///< latency histogram resolution
+
+static int64_t now;                     ///< simulated time, ns
+static int64_t irq_at = -1;             ///< strobe interrupt runs, -1 = none pending
+static int64_t handler_ns;              ///< handler start to JOYDDR write
+static long holdoff_cycles;             ///< other interrupts delay the handler up to this
+static int64_t next_report;
+static int64_t next_mainloop;
+
+static int64_t t1_period;               ///< Timer1 CTC period, ns
+static int64_t t1_zero;                 ///< Timer1 restarted
+static int64_t t1_clear;                ///< compare flag cleared
+
+static uint8_t strobe;                  ///< C64 strobe output level
+static uint8_t line;                    ///< FIRE line level the comparator has seen
+static int64_t strobe_edge;             ///< time of last strobe write that changed level
+static int edge_pending;                ///< no handler since strobe_edge
+static int64_t answer;                  ///< time the nibble after strobe_edge is on the lines
+
+/// JOYDDR writes not visible to the C64 yet
+static struct { int64_t t; uint8_t ddr; } writes[8];
+static int nwrites;
+static uint8_t visible;                 ///< JOYDDR as the C64 sees it
+static uint8_t written;                 ///< JOYDDR as last queued
+
+static long reported_x, reported_y;     ///< motion reported to c1351.c
+static long decoded_x, decoded_y;       ///< motion the C64 has decoded
+static int moving = 1;
+
+static double lat_max, lat_sum;
+static long lat_hist[8];
+static long lat_n;
+static long late_reads, aborted, stretched, completed;
+static int verbose;
+
+/// Timer1 compare flag as the firmware would read it now
+static void timer1_before() {
+    TIFR = ((now - t1_zero) / t1_period > (t1_clear - t1_zero) / t1_period) ? _BV(OCF1A) : 0;
+    TCNT1 = 1;
+}
+
+/// Firmware ran: a one written to OCF1A clears it, a zero written to TCNT1 restarts
+static void timer1_after() {
+    if (TCNT1 == 0) t1_zero = t1_clear = now;
+    if (TIFR & _BV(OCF1A)) t1_clear = now;
+    TIFR = 0;
+}
+
+/// Firmware ran: queue a JOYDDR change to show after delay
+static void joyddr_after(int64_t delay) {
+    if (DDRC != written && nwrites < 8) {
+        written = DDRC;
+        writes[nwrites].t = now + delay;
+        writes[nwrites].ddr = written;
+        nwrites++;
+    }
+}
+
+/// The comparator interrupts on every change of the line, the C64 sees the wired AND
+static void line_check() {
+    uint8_t l = strobe && !(visible & _BV(JOYFIRE));
+
+    if (l != line) {
+        line = l;
+        if (irq_at < 0) irq_at = now + (int64_t)((holdoff_cycles ? rand() % (holdoff_cycles + 1) : 0) * NS_PER_CYCLE + 0.5);
+    }
+}
+
+/// Run the strobe handler and the main loop up to time t
+static void run_until(int64_t t) {
+    while (1) {
+        int64_t next = next_mainloop;
+        int i;
+
+        if (next_report < next) next = next_report;
+        if (irq_at >= 0 && irq_at < next) next = irq_at;
+        for (i = 0; i < nwrites; i++) if (writes[i].t < next) next = writes[i].t;
+        if (next > t) break;
+        now = next;
+
+        // writes become visible
+        for (i = 0; i < nwrites; ) {
+            if (writes[i].t <= now) {
+                visible = writes[i].ddr;
+                writes[i] = writes[--nwrites];
+            } else {
+                i++;
+            }
+        }
+        line_check();
+
+        if (now == next_report) {
+            next_report += REPORT_NS;
+            if (moving) {
+                int dx = rand() % 81 - 40, dy = rand() % 81 - 40;
+                if (rand() % 20 == 0) {
+                    dx *= 8;
+                    dy *= 8;
+                }
+                reported_x += dx;
+                reported_y += dy;
+                timer1_before();
+                TIFR = 0;
+                potmouse_movt(dx, dy, 0);
+                timer1_after();
+                joyddr_after(0);
+            }
+        }
+
+        if (now == next_mainloop) {
+            next_mainloop += MAINLOOP_NS;
+            timer1_before();
+            potmouse_poll();
+            timer1_after();
+            joyddr_after(0);
+        }
+
+        if (now == irq_at) {
+            irq_at = -1;
+            // ACO is set while the line is below the bandgap
+            ACSR = (ACSR & ~_BV(ACO)) | (line ? 0 : _BV(ACO));
+            timer1_before();
+            TIFR = 0;
+            ANA_COMP_vect();
+            timer1_after();
+            joyddr_after(handler_ns);
+            // the first handler after a strobe edge answers it
+            if (edge_pending) {
+                double lat = (now + handler_ns - strobe_edge) / 1000.0;
+                int bucket = (int)(lat / BUCKET_US);
+
+                edge_pending = 0;
+                answer = now + handler_ns;
+                lat_sum += lat;
+                lat_n++;
+                if (lat > lat_max) lat_max = lat;
+                lat_hist[bucket < 7 ? bucket : 7]++;
+            }
+        }
+    }
+    now = t;
+}
+
+static void set_strobe(uint8_t level) {
+    if (level != strobe) {
+        strobe = level;
+        strobe_edge = now;
+        edge_pending = 1;
+        line_check();
+    }
+}
+
+/// Nibble on the data lines, 1 = pulled low
+static uint8_t read_nibble() {
+    uint8_t d = visible;
+    return ((d & _BV(JOYUP)) ? 1 : 0) | ((d & _BV(JOYDOWN)) ? 2 : 0) |
+           ((d & _BV(JOYLEFT)) ? 4 : 0) | ((d & _BV(JOYRIGHT)) ? 8 : 0);
+}
+
+/// \brief One read sequence of the C64 driver.
+/// \param stop nibbles read before giving up, 4 = complete
+/// \param delay_ns wait after every strobe write
+/// \param gap_ns extra wait before the strobe edge for the last nibble, the read is then not decoded
+static void c64_read(int stop, int64_t delay_ns, int64_t gap_ns) {
+    uint8_t n[4];
+    int i;
+
+    // a previous read may have left the strobe high
+    if (strobe) {
+        set_strobe(0);
+        run_until(now + delay_ns);
+    }
+
+    for (i = 0; i < stop; i++) {
+        if (i > 0) {
+            if (i == 3) run_until(now + gap_ns);
+            set_strobe(i & 1);
+            run_until(now + delay_ns);
+            if (edge_pending || now < answer) late_reads++;
+        }
+        n[i] = read_nibble();
+    }
+
+    if (stop < 4) {
+        aborted++;
+        return;
+    }
+    set_strobe(0);
+    if (gap_ns) {
+        // timed out before YL: the C64 got garbage, the deltas are sent again
+        return;
+    }
+    completed++;
+
+    decoded_x -= (int8_t)((n[0] << 4) | n[1]);     // NEOS x grows to the left
+    decoded_y += (int8_t)((n[2] << 4) | n[3]);
+}
+
+int main(int argc, char **argv) {
+    long reads = 20000, r;
+    double delay_us = C64_WAIT_US;
+    long cycles = 80;
+    int opt, i;
+    unsigned seed = 1;
+
+    while ((opt = getopt(argc, argv, "n:d:c:o:s:v")) != -1) {
+        switch (opt) {
+            case 'n': reads = atol(optarg); break;
+            case 'd': delay_us = atof(optarg); break;
+            case 'c': cycles = atol(optarg); break;
+            case 'o': holdoff_cycles = atol(optarg); break;
+            case 's': seed = (unsigned)atol(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n reads] [-d us] [-c cycles] [-o cycles] [-s seed] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    srand(seed);
+
+    t1_period = (int64_t)(T1_US(NEOS_TIMEOUT_US) * T1_PRESCALER * NS_PER_CYCLE + 0.5);
+    handler_ns = (int64_t)(cycles * NS_PER_CYCLE + 0.5);
+    next_report = REPORT_NS / 2;
+    next_mainloop = rand() % MAINLOOP_NS;
+
+    potmouse_init();
+    TCNT1 = 1;
+    potmouse_start(POTMOUSE_NEOS);
+    timer1_after();
+    visible = written = DDRC;
+    line = strobe;
+
+    for (r = 0; r < reads + SETTLE_READS; r++) {
+        int stop = 4;
+        int64_t gap = 0;
+
+        if (r == reads) moving = 0;
+        if (moving && rand() % 50 == 0) stop = 1 + rand() % 3;
+        // past the timeout and the main loop pass that notices it
+        if (moving && rand() % 50 == 0) gap = NEOS_TIMEOUT_US * 1000LL + 2 * MAINLOOP_NS;
+        if (gap) stretched++;
+
+        run_until(now + FRAME_NS - rand() % 1000000);
+        c64_read(stop, (int64_t)(delay_us * 1000), gap);
+
+        if (verbose && r % 1000 == 0) {
+            printf("read %6ld: reported %+ld %+ld decoded %+ld %+ld\n",
+                   r, reported_x, reported_y, decoded_x, decoded_y);
+        }
+    }
+
+    printf("F_CPU %lu Hz, handler %ld cycles (%.2f us), held off up to %ld cycles (%.2f us), C64 waits %.2f us\n",
+           (unsigned long)(F_CPU), cycles, handler_ns / 1000.0,
+           holdoff_cycles, holdoff_cycles * NS_PER_CYCLE / 1000.0, delay_us);
+    printf("reads: %ld complete, %ld abandoned, %ld stretched past timeout\n", completed, aborted, stretched);
+    printf("latency: mean %.2f us, max %.2f us, margin %.2f us\n",
+           lat_n ? lat_sum / lat_n : 0.0, lat_max, delay_us - lat_max);
+    for (i = 0; i < 8; i++) {
+        if (!lat_hist[i]) continue;
+        if (i < 7) {
+            printf("  %5.1f..%5.1f us: %ld\n", i * BUCKET_US, (i + 1) * BUCKET_US, lat_hist[i]);
+        } else {
+            printf("  %5.1f..      us: %ld\n", i * BUCKET_US, lat_hist[i]);
+        }
+    }
+    printf("late reads: %ld\n", late_reads);
+    printf("balance: x %+ld, y %+ld\n", reported_x - decoded_x, reported_y - decoded_y);
+
+    return (late_reads || reported_x != decoded_x || reported_y != decoded_y) ? 1 : 0;
+}
+
+//$Id$
@@ -0,0 +1,145 @@
+///\file
+///\brief POT edge placement comparison, Timer1 at clk/T1_PRESCALER vs clk/1
+///
+/// Runs the real c1351.c on the build machine. For every 1351 counter value 0..63
+/// it sets the counter with potmouse_movt(), fires the INT1 handler and reads back
+/// OCR1B and the Timer1 clock select it programmed, which gives the time the POTX
+/// edge will be placed at. This is done in both resolution modes.
+///
+/// Reported for each mode:
+///  - step: spacing of edges of consecutive counts, ideal is 2us * 100/96
+///  - error: distance of edges from the ideal straight line, after removing the
+///    constant offset that the zero point takes care of
+///  - jitter: width of random edge delay: INT1 synchronizer plus Timer1 prescaler phase,
+///    the prescaler runs freely and is not reset when Timer1 starts
+///  - flicker: chance that the C64 driver, which uses bits 6..1 of the SID value, reads
+///    a count different from the usual one for a still mouse. SID and AVR clocks are
+///    unrelated, so this is averaged over all their alignments.
+///
+/// Usage: potjitter [-v]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <avr/io.h>
+
+#include "c1351.h"
+
+void INT1_vect(void);
+
+#define PHI2_NS     (1e9 / 985248.0)        ///< PAL SID clock period
+#define STEP_NS     (2000.0 * 100 / 96)     ///< ideal 1351 count step
+#define CYCLE_NS    (1e9 / (F_CPU))         ///< AVR clock period
+#define ALIGNMENTS  256                     ///< SID/AVR clock alignments per count
+#define PHASES      64                      ///< jitter samples per alignment
+
+static int verbose;
+
+/// Prescaler selected by Timer1 clock select bits
+static int t1_prescaler(uint8_t cs) {
+    static const int presc[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    return presc[cs & 7];
+}
+
+static void compare(int hires) {
+    double edge[64], err[64];
+    double step_min = 1e9, step_max = 0, err_max = 0, err_rms = 0, mean = 0;
+    double jitter_ns, flicker = 0;
+    int presc = 1;
+    int n, a, j;
+    uint16_t ocr[64];
+
+    potmouse_init();
+    potmouse_start(POTMOUSE_C1351);
+    potmouse_hires(hires);
+    potmouse_zero(320);
+
+    // counter starts at mid-scale, step it down to 0 first
+    potmouse_movt(-040, 0, 0);
+    for (n = 0; n < 64; n++) {
+        potmouse_movt(n == 0 ? 0 : 1, 0, 0);
+        INT1_vect();
+        ocr[n] = OCR1B;
+        presc = t1_prescaler(TCCR1B);
+        edge[n] = (double)ocr[n] * presc * CYCLE_NS;
+    }
+    potmouse_movt(-63, 0, 0);
+
+    for (n = 0; n < 64; n++) {
+        err[n] = edge[n] - n * STEP_NS;
+        mean += err[n] / 64;
+        if (n > 0) {
+            double s = edge[n] - edge[n - 1];
+            if (s < step_min) step_min = s;
+            if (s > step_max) step_max = s;
+        }
+    }
+    for (n = 0; n < 64; n++) {
+        double e = err[n] - mean;
+        if (fabs(e) > err_max) err_max = fabs(e);
+        err_rms += e * e / 64;
+    }
+    err_rms = sqrt(err_rms);
+
+    // synchronizer: up to 1 cycle, prescaler phase: up to presc - 1 cycles
+    jitter_ns = presc * CYCLE_NS;
+
+    for (n = 0; n < 64; n++) {
+        for (a = 0; a < ALIGNMENTS; a++) {
+            int hist[4] = {0, 0, 0, 0};
+            int base = -1, most = 0, k;
+            double align = PHI2_NS * a / ALIGNMENTS;
+
+            for (j = 0; j < PHASES; j++) {
+                double t = edge[n] - jitter_ns * (j + 0.5) / PHASES + align;
+                int count = (int)floor(t / PHI2_NS) >> 1;
+                if (base < 0) base = count;
+                k = count - base + 1;
+                if (k >= 0 && k < 4) hist[k]++;
+            }
+            for (k = 0; k < 4; k++) if (hist[k] > most) most = hist[k];
+            flicker += (double)(PHASES - most) / PHASES;
+        }
+    }
+    flicker = 100.0 * flicker / (64 * ALIGNMENTS);
+
+    printf("%-9s %7.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.2f\n",
+           hires ? "clk/1" : (presc == 8 ? "clk/8" : "clk/N"),
+           presc * CYCLE_NS, step_min, step_max, err_max, err_rms, jitter_ns, flicker);
+
+    if (verbose) {
+        for (n = 0; n < 64; n++) {
+            printf("  %2d  OCR1B=%5u  edge=%9.1f ns  error=%+7.1f ns\n", n, ocr[n], edge[n], err[n] - mean);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    printf("F_CPU %lu Hz, ideal step %.1f ns, SID clock %.1f ns\n\n", (unsigned long)(F_CPU), STEP_NS, PHI2_NS);
+    printf("%-9s %7s %8s %8s %8s %8s %8s %8s\n",
+           "timer1", "tick", "step min", "step max", "err max", "err rms", "jitter", "flicker");
+    printf("%-9s %7s %8s %8s %8s %8s %8s %8s\n",
+           "", "ns", "ns", "ns", "ns", "ns", "ns", "%");
+
+    compare(0);
+    compare(1);
+
+    return 0;
+}
+
+//$Id$
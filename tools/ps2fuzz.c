@@ -0,0 +1,524 @@
+///\file
+///\brief Fault injection harness for the PS/2 state machine
+///
+/// Runs the real ps2.c handlers (INT0 and TIMER0 overflow) on the build machine
+/// against a simulated open-collector clock/data line pair and a PS/2 mouse model.
+/// Time is simulated in 1us steps. Timer0 counts at F_CPU through its prescaler,
+/// INT0 fires on falling clock edges while enabled, like on the ATmega8.
+/// Everything runs on one thread: while ps2_sendbyte() waits, every call it makes
+/// to timebase_ms() is one step, in which the handlers run as interrupts would.
+///
+/// The mouse streams bytes and answers host commands with ACK. It honours host
+/// inhibit by aborting and later retransmitting the byte, like real mice do.
+/// Faults are injected at random:
+///  - clock glitch: a short spurious low pulse on CLK during a frame
+///  - idle glitch: the same between frames
+///  - parity error
+///  - truncated frame: the mouse stops clocking in the middle of a byte
+///  - data noise: one data bit flipped around the sampling edge
+///  - missing ACK or ACK noise while the host transmits
+///
+/// Reported: bytes lost (clean frames never received), false bytes accepted,
+/// receiver lockups (no clean byte for LOCKUP_US while the mouse keeps sending)
+/// and the distribution of time from a fault to the next correctly received byte.
+///
+/// Usage: ps2fuzz [-n frames] [-f fault_percent] [-t tx_percent] [-s seed] [-v]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "ioconfig.h"
+#include "ps2.h"
+#include "timebase.h"
+
+void INT0_vect(void);
+void TIMER0_OVF_vect(void);
+
+#define CYCLES_PER_US   ((F_CPU) / 1000000UL)
+
+#define LOCKUP_US       200000  ///< No clean byte for this long is a lockup
+#define MATCH_WINDOW    8       ///< How far ahead a received byte is looked up
+#define MAX_FRAMES      1000000 ///< Size of the sent frames log
+
+/// Fault kinds
+enum _fault {
+    F_NONE = 0,
+    F_GLITCH,           ///< spurious clock pulse within a frame
+    F_IDLE_GLITCH,      ///< spurious clock pulse between frames
+    F_PARITY,           ///< wrong parity bit
+    F_TRUNCATE,         ///< frame cut short
+    F_NOISE,            ///< data bit flipped
+    F_ACK_MISSING,      ///< device doesn't ACK host transmission
+    F_ACK_NOISE,        ///< data noise during TX_ACK
+    F_COUNT
+};
+
+static const char *fault_names[F_COUNT] = {
+    "none", "clock glitch", "idle glitch", "parity error", "truncated frame",
+    "data noise", "missing ACK", "ACK noise"
+};
+
+/// Device states
+enum _dev_state {
+    D_GAP,              ///< pause between frames
+    D_TX,               ///< sending a frame
+    D_INHIBIT,          ///< host holds clock low
+    D_RX,               ///< receiving a host command
+};
+
+/// One byte sent by the device
+typedef struct _frame {
+    uint8_t value;
+    uint8_t fault;      ///< fault injected on first attempt
+    uint8_t good;       ///< byte must be delivered: sent without fault at least once
+    uint8_t started;    ///< transmission started
+} Frame;
+
+static Frame frames[MAX_FRAMES];
+static int nframes;             ///< frames generated
+static int cursor;              ///< first frame not yet matched against received bytes
+
+static uint64_t now;            ///< simulated time, us
+
+// line drivers, 1 = released
+static int dev_clk = 1;
+static int dev_dat = 1;
+static int glitch_left;         ///< us of forced clock low
+static int noise_left;          ///< us of inverted data
+static int prev_clk = 1;
+static int int0_pending;
+static unsigned t0_acc;         ///< Timer0 prescaler accumulator, cycles
+
+// device
+static int dev_state = D_GAP;
+static int dev_us;              ///< time within current bit or gap
+static int dev_gap;             ///< current gap length
+static int dev_bit;             ///< bit index
+static int dev_nbits;           ///< bits to send in this attempt
+static int dev_period;          ///< clock period, us
+static int dev_frame = -1;      ///< frame being sent
+static uint16_t dev_word;       ///< 11 bits of the frame, start bit first
+static int dev_retransmit;      ///< aborted frame needs retransmission
+static int dev_rx_fault;        ///< fault to inject into host command ACK
+static uint16_t dev_rx_word;    ///< bits received from host
+static int dev_reply;           ///< frame index of pending reply, or -1
+
+// statistics
+static unsigned long st_sent, st_attempts, st_received, st_lost, st_dropped, st_false;
+static unsigned long st_faults[F_COUNT];
+static unsigned long st_lockups, st_tx, st_tx_ok;
+static uint64_t fault_time;     ///< time of first unresolved fault
+static int fault_frame = -1;    ///< frame index at fault time, -1 if in sync
+static uint32_t *resync;        ///< time-to-resync samples, us
+static unsigned long nresync;
+
+static int fault_percent = 5;
+static int tx_percent = 2;
+static int verbose;
+
+static uint32_t rng = 2463534242u;
+static int in_send;             ///< ps2_sendbyte() is running, timebase_ms() steps
+
+static void sim_step();
+
+static uint32_t rnd() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int rnd_range(int lo, int hi) {
+    return lo + (int)(rnd() % (uint32_t)(hi - lo + 1));
+}
+
+/// Firmware clock for ps2.c timeouts, follows simulated time. While
+/// ps2_sendbyte() polls it, time goes on by one step per call.
+uint32_t timebase_ms() {
+    if (in_send) sim_step();
+    return (uint32_t)(now / 1000);
+}
+
+/// Level driven by the host side of a line: DDR set drives PORT, otherwise pulled up
+static int host_level(uint8_t bit) {
+    return (DDRD & _BV(bit)) ? !!(PORTD & _BV(bit)) : 1;
+}
+
+static int line_clk() {
+    return host_level(PS2CLK) & dev_clk & (glitch_left == 0);
+}
+
+static int line_dat() {
+    int d = host_level(PS2DAT) & dev_dat;
+    return noise_left ? !d : d;
+}
+
+/// Host side of the clock line only: 0 if host inhibits
+static int host_clk() {
+    return host_level(PS2CLK);
+}
+
+/// Register a fault, start resync timer if not already running
+static void fault(int kind) {
+    st_faults[kind]++;
+    if (fault_frame < 0) {
+        fault_time = now;
+        fault_frame = nframes;
+    }
+    if (verbose) printf("%10llu fault: %s\n", (unsigned long long)now, fault_names[kind]);
+}
+
+static uint16_t frame_word(uint8_t value) {
+    uint8_t parity = 1;
+    uint8_t i;
+    for (i = 0; i < 8; i++) parity ^= (value >> i) & 1;
+    // start(0), d0..d7, parity, stop(1)
+    return (uint16_t)(value << 1) | (parity << 9) | (1 << 10);
+}
+
+static int new_frame(uint8_t value) {
+    Frame *f;
+    if (nframes >= MAX_FRAMES) return -1;
+    f = &frames[nframes];
+    f->value = value;
+    f->fault = F_NONE;
+    f->good = 0;
+    f->started = 0;
+    return nframes++;
+}
+
+/// Begin sending frame idx, with faults planned on first attempt only
+static void dev_start(int idx, int first) {
+    Frame *f = &frames[idx];
+
+    dev_frame = idx;
+    dev_word = frame_word(f->value);
+    dev_nbits = 11;
+    dev_bit = 0;
+    dev_us = 0;
+    dev_period = rnd_range(60, 100);
+    dev_state = D_TX;
+    f->started = 1;
+    st_attempts++;
+
+    if (first && (int)(rnd() % 100) < fault_percent) {
+        static const uint8_t kinds[] = {F_GLITCH, F_PARITY, F_TRUNCATE, F_NOISE};
+        f->fault = kinds[rnd() % sizeof(kinds)];
+        switch (f->fault) {
+            case F_PARITY:
+                dev_word ^= 1 << 9;
+                break;
+            case F_TRUNCATE:
+                dev_nbits = rnd_range(2, 9);
+                break;
+            default:
+                break;
+        }
+    } else {
+        f->fault = F_NONE;
+    }
+
+    if (f->fault == F_NONE) f->good = 1;
+    else fault(f->fault);
+}
+
+/// One microsecond of device activity
+static void dev_step() {
+    int half = dev_period / 2;
+
+    switch (dev_state) {
+        case D_GAP:
+            if (!host_clk()) {
+                dev_state = D_INHIBIT;
+                dev_us = 0;
+                break;
+            }
+            if (++dev_us >= dev_gap) {
+                if (dev_retransmit) {
+                    dev_retransmit = 0;
+                    dev_start(dev_frame, 0);
+                } else if (dev_reply >= 0) {
+                    dev_start(dev_reply, 1);
+                    dev_reply = -1;
+                } else {
+                    int idx = new_frame((uint8_t)(nframes * 7 + 1));
+                    if (idx >= 0) {
+                        st_sent++;
+                        dev_start(idx, 1);
+                    }
+                }
+            } else if (dev_us == dev_gap / 2 && (int)(rnd() % 400) < fault_percent) {
+                glitch_left = rnd_range(1, 4);
+                fault(F_IDLE_GLITCH);
+            }
+            break;
+        case D_TX:
+            if (dev_us == 0) {
+                if (!host_clk()) {
+                    // host inhibit: abort, retransmit if before the 11th clock
+                    dev_clk = dev_dat = 1;
+                    dev_retransmit = 1;
+                    dev_state = D_INHIBIT;
+                    dev_us = 0;
+                    break;
+                }
+                dev_dat = (dev_word >> dev_bit) & 1;
+            }
+            if (dev_us == 5) dev_clk = 0;
+            if (dev_us == 5 + half) dev_clk = 1;
+            if (frames[dev_frame].fault == F_NOISE && dev_bit == 4 && dev_us == 3) noise_left = 5;
+            if (frames[dev_frame].fault == F_GLITCH && dev_bit == 5 && dev_us == 8 + half) {
+                glitch_left = rnd_range(1, 4);
+            }
+            if (++dev_us >= dev_period) {
+                dev_us = 0;
+                if (++dev_bit >= dev_nbits) {
+                    dev_clk = dev_dat = 1;
+                    dev_state = D_GAP;
+                    dev_gap = rnd_range(0, 3) ? rnd_range(100, 500) : rnd_range(2000, 8000);
+                    dev_us = 0;
+                }
+            }
+            break;
+        case D_INHIBIT:
+            if (!host_clk()) {
+                dev_us = 0;
+            } else if (++dev_us >= 50) {
+                if (!line_dat()) {
+                    // request to send
+                    dev_state = D_RX;
+                    dev_bit = 1;
+                    dev_us = 0;
+                    dev_period = rnd_range(60, 100);
+                    dev_rx_word = 0;
+                    dev_rx_fault = F_NONE;
+                    if ((int)(rnd() % 100) < fault_percent * 4) {
+                        dev_rx_fault = rnd_range(F_ACK_MISSING, F_ACK_NOISE);
+                    }
+                } else {
+                    dev_state = D_GAP;
+                    dev_gap = 0;
+                    dev_us = 0;
+                }
+            }
+            break;
+        case D_RX:
+            // clocks 1..10 read d0..d7, parity, stop on rising edge; clock 11 is ACK
+            if (dev_us == 0) {
+                if (dev_bit == 11 && dev_rx_fault != F_ACK_MISSING) dev_dat = 0;
+                dev_clk = 0;
+                if (dev_bit == 11 && dev_rx_fault != F_NONE) fault(dev_rx_fault);
+                if (dev_bit == 11 && dev_rx_fault == F_ACK_NOISE) noise_left = 3;
+            }
+            if (dev_us == half) dev_clk = 1;
+            if (dev_us == half + 2 && dev_bit <= 10) dev_rx_word |= (uint16_t)line_dat() << (dev_bit - 1);
+            if (++dev_us >= dev_period) {
+                dev_us = 0;
+                if (++dev_bit > 11) {
+                    dev_dat = 1;
+                    dev_state = D_GAP;
+                    dev_gap = rnd_range(300, 600);
+                    // command good: stop bit set, odd parity over data and parity
+                    if (dev_rx_word & (1 << 9)) {
+                        uint8_t p = 0, i;
+                        for (i = 0; i < 9; i++) p ^= (dev_rx_word >> i) & 1;
+                        if (p) {
+                            st_tx_ok++;
+                            dev_reply = new_frame(0xfa);
+                            if (dev_reply >= 0) st_sent++;
+                        }
+                    }
+                }
+            }
+            break;
+    }
+}
+
+/// Acknowledge interrupt flags cleared by firmware writing ones to GIFR
+static void fw_sync() {
+    if (GIFR & _BV(INTF0)) {
+        int0_pending = 0;
+        GIFR = 0;
+    }
+}
+
+/// One microsecond of simulated time
+static void sim_step() {
+    static const uint16_t presc[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    uint8_t cs;
+    int clk;
+
+    dev_step();
+
+    if (glitch_left) glitch_left--;
+    if (noise_left) noise_left--;
+
+    clk = line_clk();
+    PIND = (PIND & ~(_BV(PS2CLK) | _BV(PS2DAT))) | (clk << PS2CLK) | (line_dat() << PS2DAT);
+
+    if (prev_clk && !clk) int0_pending = 1;
+    prev_clk = clk;
+
+    fw_sync();
+    if (int0_pending && (GICR & _BV(INT0))) {
+        int0_pending = 0;
+        INT0_vect();
+        fw_sync();
+    }
+
+    cs = TCCR0 & 7;
+    if (presc[cs]) {
+        t0_acc += CYCLES_PER_US;
+        while (t0_acc >= presc[cs]) {
+            t0_acc -= presc[cs];
+            if (++TCNT0 == 0 && (TIMSK & _BV(TOIE0))) {
+                TIMER0_OVF_vect();
+                fw_sync();
+                cs = TCCR0 & 7;
+                if (!presc[cs]) break;
+            }
+        }
+    }
+
+    now++;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/// Match a received byte against frames sent so far
+static void receive(uint8_t b) {
+    int i, j;
+
+    st_received++;
+    for (i = cursor; i < nframes && i < cursor + MATCH_WINDOW && frames[i].started; i++) {
+        if (frames[i].value == b && frames[i].good) break;
+    }
+
+    if (i < nframes && i < cursor + MATCH_WINDOW && frames[i].started) {
+        for (j = cursor; j < i; j++) {
+            if (frames[j].good) st_lost++;
+            else st_dropped++;
+        }
+        cursor = i + 1;
+
+        if (fault_frame >= 0 && i >= fault_frame) {
+            if (nresync < MAX_FRAMES) resync[nresync++] = (uint32_t)(now - fault_time);
+            fault_frame = -1;
+        }
+    } else {
+        st_false++;
+        if (verbose) printf("%10llu false byte %02x\n", (unsigned long long)now, b);
+    }
+}
+
+static void drain() {
+    while (ps2_avail()) receive(ps2_getbyte());
+}
+
+static void check_lockup() {
+    if (fault_frame >= 0 && now - fault_time > LOCKUP_US) {
+        st_lockups++;
+        if (verbose) printf("%10llu lockup\n", (unsigned long long)now);
+        // what a supervisor would do
+        ps2_init();
+        ps2_enable_recv(1);
+        fw_sync();
+        fault_frame = -1;
+    }
+}
+
+/// Transmit a command via ps2_sendbyte(), it drives the simulation until it returns
+static void host_command(uint8_t cmd) {
+    st_tx++;
+    in_send = 1;
+    ps2_sendbyte(cmd);
+    in_send = 0;
+    drain();
+}
+
+static void report() {
+    unsigned long i;
+    static const uint32_t buckets[] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, LOCKUP_US};
+
+    printf("simulated time      %llu ms\n", (unsigned long long)(now / 1000));
+    printf("bytes sent          %lu (%lu attempts)\n", st_sent, st_attempts);
+    printf("bytes received      %lu\n", st_received);
+    printf("bytes lost          %lu\n", st_lost);
+    printf("corrupt dropped     %lu\n", st_dropped);
+    printf("false accepted      %lu\n", st_false);
+    printf("receiver lockups    %lu\n", st_lockups);
+    printf("host commands       %lu sent, %lu received by mouse\n", st_tx, st_tx_ok);
+    printf("faults injected:\n");
+    for (i = 1; i < F_COUNT; i++) printf("  %-18s%lu\n", fault_names[i], st_faults[i]);
+
+    if (nresync) {
+        qsort(resync, nresync, sizeof(uint32_t), cmp_u32);
+        printf("time to resync, us: min %u  median %u  p90 %u  p99 %u  max %u\n",
+                resync[0], resync[nresync / 2], resync[nresync * 9 / 10],
+                resync[nresync * 99 / 100], resync[nresync - 1]);
+        for (i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+            unsigned long n = 0, k;
+            for (k = 0; k < nresync; k++) n += resync[k] <= buckets[i];
+            printf("  <= %6u us  %5.1f%%\n", buckets[i], 100.0 * n / nresync);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    long target = 20000;
+
+    while ((opt = getopt(argc, argv, "n:f:t:s:v")) != -1) {
+        switch (opt) {
+            case 'n': target = atol(optarg); break;
+            case 'f': fault_percent = atoi(optarg); break;
+            case 't': tx_percent = atoi(optarg); break;
+            case 's': rng = (uint32_t)strtoul(optarg, NULL, 0) | 1; break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n frames] [-f fault%%] [-t tx%%] [-s seed] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (target >= MAX_FRAMES) target = MAX_FRAMES - 1;
+
+    resync = calloc(MAX_FRAMES, sizeof(uint32_t));
+    dev_reply = -1;
+    dev_gap = 1000;
+    PIND = _BV(PS2CLK) | _BV(PS2DAT);
+
+    ps2_init();
+    ps2_enable_recv(1);
+    fw_sync();
+
+    while (nframes < target) {
+        sim_step();
+        drain();
+        check_lockup();
+
+        // commands go out between frames, like mouse_command() would do them
+        if (dev_state == D_GAP && dev_us == 1 && !ps2_busy() && (int)(rnd() % 100) < tx_percent) {
+            host_command(0xf3);
+        }
+    }
+
+    // let the last frames arrive
+    while (dev_state != D_GAP || dev_us < 100) {
+        sim_step();
+        drain();
+    }
+
+    report();
+
+    return st_lockups ? 1 : 0;
+}
+
+//$Id$
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Static RAM per module from the linker map
+
+Reads the map file the linker writes for the firmware (mouse.map) and adds up
+the input sections that end up in RAM, .data (initialised variables and
+strings that are not in PROGMEM), .bss and .noinit, per object file. Library
+members are shown as library(member).
+
+What is left of the RAM is all the stack has, for main and for interrupt
+handlers nested on top of it. Compare with the high water mark a
+STACK_CHECK=1 build reports at run time ('S' key).
+
+-m BYTES sets the least RAM that must be left for the stack. Exit status is 1
+if less is left.
+
+Usage: ramreport.py [-r RAM] [-m BYTES] mouse.map
+"""
+
+import argparse
+import os
+import re
+import sys
+
+RAM_START = 0x800060        # ATmega8 SRAM, as the linker addresses it
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+
+# " .bss.name      0x00800100       0x12 file.o", or the name alone on a line
+# with address, size and file on the next one
+INPUT = re.compile(r"^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+INPUT_NAME = re.compile(r"^ (\S+)\s*$")
+INPUT_REST = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+OUTPUT = re.compile(r"^(\.\S+)(\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+))?")
+FILL = re.compile(r"^ \*fill\*\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+
+
+def module(path):
+    """Short module name: file, or library(member)"""
+    m = re.match(r"(.*)\((.*)\)$", path)
+    if m:
+        return "%s(%s)" % (os.path.basename(m.group(1)), m.group(2))
+    return os.path.basename(path)
+
+
+def parse(lines):
+    """Yield (output section, module, size) of input sections placed in RAM"""
+    out = None
+    pending = None
+    in_map = False
+    for line in lines:
+        line = line.rstrip("\n")
+        if line.startswith("Linker script and memory map"):
+            in_map = True
+            continue
+        if not in_map:
+            continue
+
+        m = OUTPUT.match(line)
+        if m:
+            out = m.group(1) if m.group(1) in RAM_SECTIONS else None
+            pending = None
+            continue
+        if out is None:
+            continue
+
+        if pending:
+            m = INPUT_REST.match(line)
+            pending = None
+            if m:
+                addr, size, path = int(m.group(1), 16), int(m.group(2), 16), m.group(3)
+                if size and addr >= RAM_START:
+                    yield out, module(path), size
+                continue
+
+        m = FILL.match(line)
+        if m:
+            if int(m.group(1), 16) >= RAM_START:
+                yield out, "(alignment)", int(m.group(2), 16)
+            continue
+        m = INPUT.match(line)
+        if m:
+            name, addr, size, path = m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+            if size and addr >= RAM_START and not path.startswith("0x"):
+                yield out, module(path), size
+            continue
+        m = INPUT_NAME.match(line)
+        if m and not m.group(1).startswith("*"):
+            pending = m.group(1)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Static RAM per module from linker map")
+    ap.add_argument("map", help="linker map file")
+    ap.add_argument("-r", "--ram", type=int, default=1024, help="RAM size, bytes")
+    ap.add_argument("-m", "--min-stack", type=int, default=0, metavar="BYTES",
+                    help="least RAM that must be left for the stack")
+    args = ap.parse_args()
+
+    try:
+        with open(args.map) as f:
+            entries = list(parse(f))
+    except OSError as e:
+        print("ramreport: %s" % e, file=sys.stderr)
+        return 2
+
+    modules = {}
+    totals = dict((s, 0) for s in RAM_SECTIONS)
+    for sect, mod, size in entries:
+        modules.setdefault(mod, dict((s, 0) for s in RAM_SECTIONS))[sect] += size
+        totals[sect] += size
+
+    print("%-28s %6s %6s %7s %6s" % ("module", "data", "bss", "noinit", "total"))
+    for mod, s in sorted(modules.items(), key=lambda kv: (-sum(kv[1].values()), kv[0])):
+        print("%-28s %6d %6d %7d %6d" % (mod, s[".data"], s[".bss"], s[".noinit"], sum(s.values())))
+
+    static = sum(totals.values())
+    left = args.ram - static
+    print("%-28s %6d %6d %7d %6d" % ("total", totals[".data"], totals[".bss"], totals[".noinit"], static))
+    print("RAM %d bytes, static %d, left for stack %d" % (args.ram, static, left))
+
+    if left < args.min_stack:
+        print("ramreport: %d bytes left for stack, need %d" % (left, args.min_stack), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,20 +1,21 @@
 //! \file
 //! \brief USART interface
-
-#include <stdio.h>
+//!
+//! Both directions go through ring buffers: the receive interrupt puts into rx and
+//! the main loop takes, the main loop puts into tx and the data register empty
+//! interrupt takes. Keys typed while the main loop is busy beyond RX_BUFFER_SIZE
+//! are dropped and counted, see uart_rxstats().
+
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
+#include "ring.h"
 #include "usrat.h"
 
-static uint8_t rx_buffer[RX_BUFFER_SIZE];
-static volatile uint8_t rx_buffer_in;
-static volatile uint8_t rx_buffer_out;
-
-//! \brief a stub to use when usart is disabled
-static void uart_non(char data) {
-}
+RING(rx, RX_BUFFER_SIZE);
+RING(tx, TX_BUFFER_SIZE);
 
-//! \brief Initialize USART, perform fdevopen with uart_putchar.
+//! \brief Initialize USART.
 //! \param baudval (F_CPU/(16*baudrate))-1
 //! \sa uart_putchar()
 void usart_init(uint16_t baudval) {
@@ -22,36 +23,55 @@ void usart_init(uint16_t baudval) {
 	UBRRH = (uint8_t)(baudval>>8);
 	UBRRL = (uint8_t)baudval;
 
-	rx_buffer_in = rx_buffer_out = 0;
+	ring_init(&rx);
+	ring_init(&tx);
 
 	// Set frame format: 8 data, 1 stop bit
 	UCSRC = (uint8_t)((1<<URSEL) | (0<<USBS) | (3<<UCSZ0));
 	
 	// Enable receiver and transmitter, enable RX complete interrupt
 	UCSRB = (uint8_t)((1<<RXEN) | (1<<TXEN) | (1<<RXCIE));
-
-	(void)fdevopen(uart_putchar, NULL/*, 0*/);
 }
 
-//! \brief Disable USART completely
+//! \brief Disable USART completely. Output is discarded from now on.
 void usart_stop() {
     UCSRB = 0;
-    (void)fdevopen(uart_non,NULL);
 }
 
-//! \brief putchar() for USART.
-//! \param data character to print.
+//! \brief Free space in transmit buffer.
+//! \return number of bytes that uart_write() can take without waiting, 0 if USART is stopped
+uint8_t uart_txspace() {
+	if (!(UCSRB & (1<<TXEN))) return 0;
+
+	return ring_space(&tx);
+}
+
+//! \brief Nonblocking write, no newline translation. 
+//! \param data bytes to transmit
+//! \param len length, must not exceed uart_txspace()
+void uart_write(const uint8_t *data, uint8_t len) {
+	ring_write(&tx, data, len);
+	UCSRB |= (1<<UDRIE);
+}
+
+//! \brief putchar() for USART. Waits only if transmit buffer is full.
+//! \param data character to print, discarded if USART is stopped
 int uart_putchar(char data) {
-	//while (!(UCSRA & (1<<UDRE))) {};
+	if (!(UCSRB & (1<<TXEN))) return 0;
+
 	if (data == '\n') {
 		(void)uart_putchar('\r');
 	}
 
-	//PORTD |= 1<<5;
-	while (!(UCSRA & (1<<UDRE))) {};
-	//PORTD &= (uint8_t)(~(1<<5));
+	while (uart_txspace() == 0) {
+		// with interrupts disabled nobody else will drain the buffer
+		if (!(SREG & 0x80) && (UCSRA & (1<<UDRE))) {
+			UDR = ring_get(&tx);
+		}
+	}
 
-	UDR = (uint8_t)data;
+	ring_put(&tx, (uint8_t)data);
+	UCSRB |= (1<<UDRIE);
 
 	return 0;
 }
@@ -66,23 +86,66 @@ int uart_getchar() {
 }
 
 //! \brief Check data availability in USART buffer.
-//! \return 1 if buffer is not empty.
+//! \return number of bytes in receive buffer, 0 if empty.
 uint8_t uart_available() {
-	return rx_buffer_in != rx_buffer_out;
+	return ring_count(&rx);
 }
 
 //! \brief Nonblocking, nonchecking getchar for USART. Use with care.
 uint8_t uart_getc() {
-	uint8_t result = rx_buffer[rx_buffer_out];
-	rx_buffer_out = (rx_buffer_out + 1) % RX_BUFFER_SIZE;
-	
-	return result;
+	return ring_get(&rx);
+}
+
+//! \brief Receive buffer overflows and high water mark.
+//! \param st receives counters since usart_init() or last clear
+//! \param clear 1 = start counting from zero
+void uart_rxstats(RingStats *st, uint8_t clear) {
+	ring_stats(&rx, st, clear);
 }
 
-void SIG_UART_RECV( void ) __attribute__ ( ( signal ) );  
+//! \brief Interrupt entry that masks its own source in UCSRB and lets all others in.
+//! A signal handler saves its registers before the first statement, with interrupts
+//! still off, which would hold the SID and NEOS strobe interrupts off for the whole
+//! prologue. This runs before it: 9 cycles from request to sei. Then it jumps to
+//! body, a signal handler that saves what it uses and ends with reti. Its name has
+//! the __vector prefix, or avr-gcc takes it for a misspelled handler name.
+#define UART_ENTRY(bit, body)						\
+	__asm__ __volatile__ (						\
+		"cbi %0, %1"	"\n\t"					\
+		"sei"		"\n\t"					\
+		"rjmp " #body	"\n\t"					\
+		:: "I" (_SFR_IO_ADDR(UCSRB)), "I" (bit))
+
+//! Lets the SID interrupts in too. Reading UDR clears RXC unless another
+//! character is waiting, so RXCIE is cleared before sei() like UDRIE below.
+void SIG_UART_RECV( void ) __attribute__ ( ( naked ) );  
 void SIG_UART_RECV( void ) {
-	rx_buffer[rx_buffer_in] = (uint8_t)UDR;
-	rx_buffer_in = (rx_buffer_in + 1) % RX_BUFFER_SIZE;
+	UART_ENTRY(RXCIE, __vector_uart_recv);
+}
+
+void __vector_uart_recv( void ) __attribute__ ( ( signal, used ) );
+void __vector_uart_recv( void ) {
+	ring_put(&rx, (uint8_t)UDR);
+	UCSRB |= (1<<RXCIE);
+}
+
+//! Fires every character time while there is output, so it lets the SID
+//! interrupts in: UDRE stays set until UDR is written, so UDRIE is cleared
+//! before sei() or the handler would come right back into itself. Nobody else
+//! changes UDRIE while the main loop is held here.
+void SIG_UART_DATA( void ) __attribute__ ( ( naked ) );  
+void SIG_UART_DATA( void ) {
+	UART_ENTRY(UDRIE, __vector_uart_data);
+}
+
+void __vector_uart_data( void ) __attribute__ ( ( signal, used ) );
+void __vector_uart_data( void ) {
+	if (ring_count(&tx)) {
+		UDR = ring_get(&tx);
+	}
+	if (ring_count(&tx)) {
+		UCSRB |= (1<<UDRIE);
+	}
 }
 
 // $Id$
@@ -3,15 +3,32 @@
 #ifndef _USRAT_H
 #define _USRAT_H
 
-#define RX_BUFFER_SIZE	4					//!< USART RX buffer length
+#include "ring.h"
+
+#define RX_BUFFER_SIZE	16					//!< USART RX buffer length, power of 2
+#define TX_BUFFER_SIZE	64					//!< USART TX buffer length, power of 2
+
+//! UBRR value for given baudrate, rounded to nearest
+#define USART_UBRR(baud)	(((F_CPU) + 8UL*(baud))/(16UL*(baud)) - 1)
+
+//! Actual baudrate for given requested baudrate
+#define USART_ACTUAL(baud)	((F_CPU)/(16UL*(USART_UBRR(baud)+1)))
+
+//! Actual baudrate deviation from requested, in permille
+#define USART_ERROR_PERMILLE(baud)	\
+	(((USART_ACTUAL(baud) > (baud)) ? (USART_ACTUAL(baud) - (baud)) : ((baud) - USART_ACTUAL(baud))) \
+	 * 1000UL / (baud))
 
 void usart_init(uint16_t baudrate);
 void usart_stop();
 
 int uart_putchar(char data);
+uint8_t uart_txspace();
+void uart_write(const uint8_t *data, uint8_t len);
 int uart_getchar();
 uint8_t uart_available(void);
 uint8_t uart_getc();
+void uart_rxstats(RingStats *st, uint8_t clear);
 
 #endif
 
@@ -0,0 +1,200 @@
+///\file
+///\brief VT-Paint doodle app for VT220 terminal attached to USART
+///
+/// Mouse cursor moves over 80x24 screen, one character cell per 33 counts
+/// horizontally and 66 counts vertically. With a button pressed it leaves a trail.
+/// The status line at the top shows absolute position and buttons.
+///
+/// It is meant to watch live motion without affecting what the C64 sees, so
+/// vtpaint_movt() only updates the model: cell position is kept in accumulators
+/// that need no division, and cells to redraw go into a small queue.
+/// vtpaint_update() renders changes into escape sequences and puts them into
+/// the USART transmit buffer only if they fit completely, otherwise tries again
+/// next time. Status line is compared with what's on screen and only the
+/// changed span is sent.
+
+#include <inttypes.h>
+#include <avr/io.h>
+
+#include "usrat.h"
+#include "out.h"
+#include "mouse.h"
+#include "vtpaint.h"
+
+#define CELL_W      33      ///< counts per cell horizontally
+#define CELL_H      66      ///< counts per cell vertically
+#define HOME_ROW    12      ///< cursor row at origin
+#define HOME_COL    40      ///< cursor column at origin
+
+#define STATUS_LEN  25      ///< "X=+nnnnn Y=+nnnnn [@ @ @]"
+#define QUEUE_LEN   16      ///< cell writes waiting for output, power of 2
+
+/// One character cell write
+typedef struct _cellop {
+    uint8_t row;
+    uint8_t col;
+    char ch;
+} CellOp;
+
+static int16_t absolute_x, absolute_y;      ///< absolute position, counts
+static int16_t cell_x, cell_y;              ///< cursor cell relative to home
+static uint8_t sub_x, sub_y;                ///< position within cell, counts
+static uint8_t last_buttons;
+
+static CellOp queue[QUEUE_LEN];             ///< trail cells to draw
+static uint8_t queue_head, queue_tail;
+static CellOp cursor;                       ///< cursor cell to draw
+static uint8_t cursor_dirty;
+static uint8_t status_dirty;
+static char status_shown[STATUS_LEN];       ///< status line as it is on screen
+
+void vtpaint_init() {
+    absolute_x = absolute_y = 0;
+    cell_x = cell_y = 0;
+    sub_x = sub_y = 0;
+    last_buttons = 0;
+    queue_head = queue_tail = 0;
+    cursor_dirty = 0;
+    status_dirty = 1;
+    
+    // nothing known to be on screen
+    for (uint8_t i = 0; i < STATUS_LEN; i++) status_shown[i] = 0;
+}
+
+/// \brief Move within cells without dividing.
+/// \param cell cell coordinate
+/// \param sub position within cell, 0..size-1
+/// \param d movement, -256..255
+/// \param size cell size in counts
+static void cell_move(int16_t *cell, uint8_t *sub, int16_t d, uint8_t size) {
+    int16_t s = *sub + d;
+    
+    while (s >= size) {
+        s -= size;
+        ++*cell;
+    }
+    while (s < 0) {
+        s += size;
+        --*cell;
+    }
+    *sub = (uint8_t)s;
+}
+
+static uint8_t clamp(int16_t v, uint8_t max) {
+    if (v < 1) return 1;
+    if (v > max) return max;
+    return (uint8_t)v;
+}
+
+/// \brief Queue cell write, merge with the last one if it's the same cell.
+static void queue_cell(uint8_t row, uint8_t col, char ch) {
+    uint8_t last = (queue_head - 1) % QUEUE_LEN;
+    
+    if (queue_head != queue_tail && queue[last].row == row && queue[last].col == col) {
+        queue[last].ch = ch;
+        return;
+    }
+    
+    // full: oldest trail dot is lost
+    if ((uint8_t)(queue_head - queue_tail) % QUEUE_LEN == QUEUE_LEN - 1) {
+        queue_tail = (queue_tail + 1) % QUEUE_LEN;
+    }
+    
+    queue[queue_head].row = row;
+    queue[queue_head].col = col;
+    queue[queue_head].ch = ch;
+    queue_head = (queue_head + 1) % QUEUE_LEN;
+}
+
+void vtpaint_movt(int16_t dx, int16_t dy, uint8_t buttons) {
+    int16_t old_x = cell_x, old_y = cell_y;
+    
+    absolute_x += dx;
+    absolute_y += dy;
+    
+    cell_move(&cell_x, &sub_x, dx, CELL_W);
+    cell_move(&cell_y, &sub_y, dy, CELL_H);
+    
+    if (old_x != cell_x || old_y != cell_y || last_buttons != buttons) {
+        // leave a trail where the cursor was
+        queue_cell(clamp(HOME_ROW - old_y, 24), clamp(HOME_COL + old_x, 80), buttons ? '#' : ' ');
+        
+        cursor.row = clamp(HOME_ROW - cell_y, 24);
+        cursor.col = clamp(HOME_COL + cell_x, 80);
+        cursor.ch = buttons + '0';
+        cursor_dirty = 1;
+        
+        last_buttons = buttons;
+    }
+    
+    status_dirty = 1;
+}
+
+/// \brief Send one cell write if it fits.
+/// \return 1 if sent
+static uint8_t send_cell(CellOp *op) {
+    char buf[10];
+    uint8_t len = fmt_goto(buf, op->row, op->col) - buf;
+    
+    buf[len++] = op->ch;
+    if (uart_txspace() < len) return 0;
+    
+    uart_write((uint8_t *)buf, len);
+    return 1;
+}
+
+/// \brief Send changed part of status line if it fits.
+/// \return 1 if status line on screen is up to date
+static uint8_t send_status() {
+    char line[STATUS_LEN];
+    char buf[8];
+    uint8_t first, last, len;
+    
+    line[0] = 'X';
+    line[1] = '=';
+    fmt_sdec(line + 2, absolute_x, 6, 1);
+    line[8] = ' ';
+    line[9] = 'Y';
+    line[10] = '=';
+    fmt_sdec(line + 11, absolute_y, 6, 1);
+    line[17] = ' ';
+    line[18] = '[';
+    line[19] = (last_buttons & _BV(BUTTON1)) ? '@' : ' ';
+    line[20] = ' ';
+    line[21] = (last_buttons & _BV(BUTTON3)) ? '@' : ' ';
+    line[22] = ' ';
+    line[23] = (last_buttons & _BV(BUTTON2)) ? '@' : ' ';
+    line[24] = ']';
+    
+    for (first = 0; first < STATUS_LEN && line[first] == status_shown[first]; first++);
+    if (first == STATUS_LEN) return 1;
+    for (last = STATUS_LEN - 1; line[last] == status_shown[last]; last--);
+    
+    len = fmt_goto(buf, 1, first + 1) - buf;
+    if (uart_txspace() < len + last - first + 1) return 0;
+    
+    uart_write((uint8_t *)buf, len);
+    uart_write((uint8_t *)line + first, last - first + 1);
+    for (; first <= last; first++) status_shown[first] = line[first];
+    
+    return 1;
+}
+
+void vtpaint_update() {
+    // trail first, then cursor on top of it
+    while (queue_tail != queue_head) {
+        if (!send_cell(&queue[queue_tail])) return;
+        queue_tail = (queue_tail + 1) % QUEUE_LEN;
+    }
+    
+    if (cursor_dirty) {
+        if (!send_cell(&cursor)) return;
+        cursor_dirty = 0;
+    }
+    
+    if (status_dirty && send_status()) {
+        status_dirty = 0;
+    }
+}
+
+//$Id$
@@ -0,0 +1,23 @@
+///\file
+///\brief VT-Paint doodle app interface
+
+#ifndef _VTPAINT_H
+#define _VTPAINT_H
+
+#include <inttypes.h>
+
+/// Reset picture state. Screen is expected to be clear.
+void vtpaint_init();
+
+/// \brief Account mouse movement. Cheap, doesn't output anything.
+/// \param dx x movement
+/// \param dy y movement
+/// \param buttons button state
+void vtpaint_movt(int16_t dx, int16_t dy, uint8_t buttons);
+
+/// Send whatever changed on screen, as much as fits in USART buffer. Never waits.
+void vtpaint_update();
+
+#endif
+
+//$Id$